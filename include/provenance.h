@@ -70,6 +70,23 @@ void long_prov_record(union long_prov_elt* msg);
 */
 bool provenance_is_present(void);
 
+/*
+* @path securityfs control file (e.g. PROV_SELF_FILE)
+* read or write a control file at offset 0 through a descriptor kept open
+* across calls. Return the result of pread/pwrite (-1 and errno on error).
+*/
+ssize_t provenance_control_read(const char* path, void* buf, size_t length);
+ssize_t provenance_control_write(const char* path, const void* buf, size_t length);
+
+/*
+* close the cached control file descriptors, they are reopened on next use.
+* Must not be called concurrently with other library calls. Called
+* automatically in a forked child. Applications closing descriptors they did
+* not open (e.g. closefrom when daemonizing) should call it afterwards; a
+* reused descriptor is detected before writes, reads only detect it on error.
+*/
+void provenance_control_close(void);
+
 /* provenance usher functions */
 
 /*
@@ -84,6 +101,53 @@ int provenance_relay_register(struct provenance_ops* ops, const char* name);
 */
 void provenance_relay_stop(void);
 
+/*
+* @threads number of serialization threads, 0 to run callbacks on the relay
+* reader threads (default)
+* @length maximum number of relay reads waiting for a serialization thread
+* when threads is not 0, relay readers only drain the relay files and queue
+* what they read, callbacks (including init) run on the serialization threads.
+* Readers block when the queue is full. Must be called before
+* provenance_relay_register.
+*/
+int provenance_relay_set_workers(uint32_t threads, uint32_t length);
+
+struct relay_snapshot{
+  bool processes;             // every process in /proc
+  const char** directories;   // walked for files, may be NULL
+  size_t directory_count;
+  bool tracked_only;          // only files marked as tracked
+  uint32_t threads;           // 0 for one per online CPU
+};
+
+/*
+* @snapshot what to report, NULL to disable (default). directories must stay
+* valid until provenance_relay_register returns.
+* when the relay is registered, existing processes and files are read and
+* delivered through the normal callbacks (including init and filter) before
+* live records. Relay readers are already running: what happens meanwhile is
+* read and kept in memory until the snapshot completes.
+* Must be called before provenance_relay_register.
+*/
+int provenance_relay_set_snapshot(const struct relay_snapshot* snapshot);
+
+struct provenance_relay_stats{
+  uint32_t workers;         // number of serialization threads
+  uint32_t depth;           // relay reads currently queued
+  uint32_t max_depth;       // highest depth observed
+  uint64_t depth_records;   // records currently queued
+  uint64_t queued;          // relay reads queued since start
+  uint64_t queued_records;
+  uint64_t processed;       // relay reads processed since start
+  uint64_t processed_records;
+  uint64_t blocked;         // times a reader waited on a full queue
+};
+
+/*
+* @stats filled with the serialization stage counters
+*/
+int provenance_relay_stats(struct provenance_relay_stats* stats);
+
 /* security file manipulation */
 
 /*
@@ -214,6 +278,22 @@ int provenance_disclose_node(struct disc_node_struct* node);
 */
 int provenance_disclose_relation(struct relation_struct* relation);
 
+/*
+* @nodes array of nodes to be recorded
+* @count number of nodes
+* disclose nodes in batches through a single descriptor, identifiers are
+* filled in place. Return the number of nodes disclosed (elements after it
+* were not) or a negative value if none was.
+*/
+int provenance_disclose_nodes(struct disc_node_struct* nodes, size_t count);
+
+/*
+* @relations array of relations to be recorded
+* @count number of relations
+* same as provenance_disclose_nodes for relations.
+*/
+int provenance_disclose_relations(struct relation_struct* relations, size_t count);
+
 /*
 * @self point to a node data structure
 * self if filled with the provenance information corresponding to the current
@@ -320,6 +400,32 @@ int provenance_propagate_process(uint32_t pid, bool propagate);
 
 int provenance_label_process(uint32_t pid, const char *label);
 
+enum process_op{
+  PROCESS_TRACK,
+  PROCESS_OPAQUE,
+  PROCESS_PROPAGATE,
+  PROCESS_LABEL
+};
+
+/*
+* @pids processes pid
+* @count number of pids
+* @op operation to apply
+* @value set or clear the flag, ignored by PROCESS_LABEL
+* @label label for PROCESS_LABEL, ignored otherwise
+* @results set to 0 or a negative errno value for each pid, may be NULL
+* apply the same change to a set of processes, batching the writes to the
+* process control file. Return the number of pids that failed or a negative
+* errno value.
+*/
+int provenance_processes_apply(const uint32_t* pids, size_t count, enum process_op op, bool value, const char* label, int* results);
+
+/*
+* @param "a.b.c.d/mask:port"
+* @filter filled with the address, mask and port in network order (op unset)
+*/
+int provenance_ipv4_filter_parse(const char* param, struct prov_ipv4_filter* filter);
+
 int provenance_ingress_ipv4_track(const char* param);
 int provenance_ingress_ipv4_propagate(const char* param);
 int provenance_ingress_ipv4_record(const char* param);
@@ -334,6 +440,13 @@ int provenance_egress_ipv4( struct prov_ipv4_filter* filters, size_t length );
 
 int provenance_secid_to_secctx( uint32_t secid, char* secctx, uint32_t len);
 
+/*
+* @bytes memory budget of the secctx cache
+* set the size of the process-wide cache used by provenance_secid_to_secctx.
+* Must be called before the first conversion, return -EBUSY otherwise.
+*/
+int provenance_secctx_cache_size(size_t bytes);
+
 int provenance_secctx_track(const char* secctx);
 int provenance_secctx_propagate(const char* secctx);
 int provenance_secctx_opaque(const char* secctx);
@@ -360,6 +473,13 @@ int provenance_ns(struct nsinfo* filters, size_t length);
 
 int provenance_policy_hash(uint8_t* buffer, size_t length);
 
+/*
+* load the node and relation type vocabulary from the kernel. This is done
+* once per process (provenance_relay_register does it at startup), afterward
+* type conversions below do not perform any system call.
+*/
+int provenance_load_types(void);
+
 char* relation_id_to_str(uint64_t id);
 char* node_id_to_str(uint64_t id);
 
@@ -13,7 +13,39 @@
 #define __PROVENANCEPROVJSON_H
 
 void set_ProvJSON_callback( void (*fcn)(char* json) );
+
+struct provenance_sink;
+/*
+* @sink sink receiving ProvJSON batches (see provenancesink.h), NULL to disable
+* batches are written to sink instead of being passed to the callback.
+*/
+void set_ProvJSON_sink( struct provenance_sink* sink );
+
+/*
+* @fcn callback receiving compressed frames (NULL to disable)
+* @level zlib compression level (-1 for default, 0 to 9)
+* when set, each ProvJSON batch is deflated and delivered to fcn instead of
+* the callback registered with set_ProvJSON_callback. Frames are formatted as
+* described in provenanceutils.h and can be decoded with decompress_frame.
+* Waits for the batch being written out, must not be called from fcn.
+*/
+int set_ProvJSON_compressed_callback( void (*fcn)(uint8_t* frame, size_t length), int level );
 void flush_json( void );
+
+/*
+* @v boolean value
+* when set, node references within a ProvJSON batch (prov:entity,
+* prov:activity, cf:hasParent...) are written "@n", n indexing the "cf:dict"
+* array added to the document.
+*/
+int set_ProvJSON_compact( bool v );
+
+/*
+* @json a ProvJSON document, compact or not
+* return a newly allocated standard ProvJSON document (to be freed by the
+* caller), NULL on error.
+*/
+char* ProvJSON_expand( const char* json );
 void append_activity(char* json_element);
 void append_agent(char* json_element);
 void append_entity(char* json_element);
@@ -32,8 +64,99 @@ void append_derived(char* json_element);
 int disclose_node_ProvJSON(uint64_t type, const char* content, union prov_identifier* identifier);
 int disclose_relation_ProvJSON(uint64_t type, union prov_identifier* sender, union prov_identifier* receiver);
 
+/*
+* @slots number of nodes per serializing thread whose last state is kept, 0
+* disables delta mode
+* @snapshot a full record is emitted at least every snapshot versions
+* when enabled, a new version of a task or inode node only carries its
+* identity, the attributes that changed and "cf:delta_of" referencing the
+* previous version. A full record is emitted instead when an attribute of
+* the previous version would be omitted (e.g. taint cleared). Should be set
+* at startup.
+*/
+int set_ProvJSON_delta(uint32_t slots, uint32_t snapshot);
+
+/*
+* @hits set to the number of identifiers served from the encoding cache
+* @misses set to the number of identifiers that had to be encoded
+* statistics of the per-thread identifier encoding caches. Threads report
+* their counters periodically, values lag slightly behind.
+*/
+void ProvJSON_id_cache_stats(uint64_t* hits, uint64_t* misses);
+
+struct blob_store;
+/*
+* @store blob store (see provenanceblob.h), NULL to disable
+* @threshold payloads shorter than threshold bytes stay inline
+* when set, packet content and argv/envp values are written once to store
+* and replaced in records by "blob:" followed by the hexadecimal digest.
+* Should be set at startup.
+*/
+void set_ProvJSON_blob_store(struct blob_store* store, size_t threshold);
+
+/* record schemas shared by the serializers */
+enum prov_field_kind{
+  FIELD_UINT,           // unsigned integer
+  FIELD_INT,            // signed integer
+  FIELD_UINT_STR,       // unsigned integer, quoted (64 bits values)
+  FIELD_INT_STR,        // signed integer, quoted (64 bits values)
+  FIELD_HEX,            // quoted hexadecimal with 0x prefix
+  FIELD_HEX_STR,        // quoted hexadecimal
+  FIELD_STRING,         // null terminated char array
+  FIELD_BOOL,           // "true" if the byte equals match
+  FIELD_MACHINE,        // machine id
+  FIELD_NODE_TYPE,      // node type converted to string
+  FIELD_RELATION_TYPE,  // relation type converted to string
+  FIELD_SECCTX,         // secid converted to security context
+  FIELD_UUID,           // 16 bytes uuid
+  FIELD_DATE,           // serialization date, member is ignored
+  FIELD_TAINT,          // taint bloom filter
+  FIELD_REFERENCE,      // union prov_identifier of another element
+  FIELD_BASE64,         // byte array, length (size_t) at offset aux
+  FIELD_IPV4,           // ipv4 address, port (uint16_t) at offset aux
+  FIELD_SOCKADDR        // struct sockaddr, length (size_t) at offset aux
+};
+
+#define FIELD_NONZERO   0x01  // omitted when the value is zero
+#define FIELD_IF_EQUAL  0x02  // omitted unless the byte at offset aux equals match
+#define FIELD_ALWAYS    0x04  // identity attribute, present in delta records
+#define FIELD_BLOB      0x08  // payload that can be moved to the blob store
+#define FIELD_POSITIVE  0x10  // omitted unless the (signed) value is above zero
+
+struct prov_field{
+  const char* name;     // attribute name, e.g. "cf:uid"
+  const char* key;      // precomputed JSON key fragment, e.g. ",\"cf:uid\":"
+  uint8_t key_len;
+  uint8_t kind;
+  uint8_t opt;
+  uint8_t match;
+  uint16_t offset;      // offset of the member within the kernel structure
+  uint16_t size;        // size of the member
+  uint16_t aux;
+};
+
+/*
+* @type node or relation type
+* @count set to the number of fields
+* return the field table describing the structure used for records of this
+* type, or NULL if the type is unknown. Fields are in serialization order.
+*/
+const struct prov_field* provenance_schema(uint64_t type, size_t* count);
+
+/*
+* @type node or relation type
+* @names attributes to emit (e.g. "cf:pid", "prov:label", "cf:path" for
+* inodes), NULL for all
+* @count number of names
+* restrict the attributes serialized for records of type. Types sharing a
+* structure (e.g. inode types, relations of a same category) share the same
+* projection. Excluded attributes are neither looked up nor formatted. Should
+* be set at startup, before records are serialized. Return -EINVAL if the
+* type is unknown and -ENOENT if an attribute does not exist.
+*/
+int set_ProvJSON_projection(uint64_t type, const char* names[], size_t count);
+
 /* struct to json functions */
-/* TODO provide clean implementation? right now probably highly inneficient */
 char* relation_to_json(struct relation_struct* e);
 char* used_to_json(struct relation_struct* e);
 char* generated_to_json(struct relation_struct* e);
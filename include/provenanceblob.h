@@ -0,0 +1,68 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCEBLOB_H
+#define __PROVENANCEBLOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+* Content-addressed store for large payloads (packet content, argv/envp).
+* Each distinct payload is written once to an append-only file and referred
+* to by its 128 bits digest. Digests are keyed (SipHash-2-4-128) with a random
+* key kept in the file header, so payloads controlled by an attacker cannot be
+* crafted to collide. Digests are therefore only meaningful within a store.
+*
+* File layout: "CFBLOB01" magic, 16 bytes key, then records made of the
+* digest, the payload length (32 bits little endian) and the payload.
+*/
+#define BLOB_DIGEST_LENGTH  16
+#define BLOB_DIGEST_STR_LEN (BLOB_DIGEST_LENGTH*2+1)
+#define BLOB_MAX_LENGTH     UINT32_MAX
+
+struct blob_store;
+
+struct blob_stats{
+  uint64_t blobs;   // distinct payloads in the store
+  uint64_t bytes;   // payload bytes in the store
+  uint64_t hits;    // payloads already present when stored
+  uint64_t misses;  // payloads appended to the store
+};
+
+/*
+* @path blob file, created if it does not exist
+* open a store, the index of an existing file is rebuilt and a partially
+* written trailing record is discarded. Return NULL on error (errno is set).
+*/
+struct blob_store* blob_store_open(const char* path);
+void blob_store_close(struct blob_store* store);
+
+/*
+* @digest set to the digest of data
+* store data if it is not already present. Thread safe.
+* Return 1 if data was appended, 0 if it was present, a negative errno value
+* on error.
+*/
+int blob_store_put(struct blob_store* store, const void* data, size_t length, uint8_t* digest);
+
+/*
+* @data buffer receiving the payload
+* @length size of data
+* Return the payload length (which may exceed length, data is then
+* truncated), -ENOENT if digest is unknown or a negative errno value.
+*/
+ssize_t blob_store_get(struct blob_store* store, const uint8_t* digest, void* data, size_t length);
+
+void blob_store_stats(struct blob_store* store, struct blob_stats* stats);
+
+#endif /* __PROVENANCEBLOB_H */
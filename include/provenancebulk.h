@@ -0,0 +1,129 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCEBULK_H
+#define __PROVENANCEBULK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "provenance.h"
+#include "provenanceutils.h"
+
+enum tree_op{
+  TREE_TRACK,
+  TREE_OPAQUE,
+  TREE_PROPAGATE,
+  TREE_LABEL,
+  TREE_READ         // read provenance and pass it to config->inode
+};
+
+struct tree_progress{
+  uint64_t directories;   // directories visited
+  uint64_t entries;       // entries seen, directories included
+  uint64_t updated;       // entries the operation was applied to
+  uint64_t skipped;       // excluded, not included, symlinks, other filesystems
+  uint64_t errors;
+};
+
+struct tree_config{
+  enum tree_op op;
+  bool value;               // set or clear, ignored by TREE_LABEL
+  const char* label;        // TREE_LABEL
+  /* TREE_READ, called concurrently from worker threads, path relative to the root */
+  void (*inode)(union prov_elt* inode, const char* path, void* data);
+  /*
+  * fnmatch patterns, matched against the path relative to the root when they
+  * contain a '/', against the entry name otherwise. An excluded directory is
+  * not descended into. Directories are always descended into, include only
+  * restricts the entries the operation is applied to. NULL for none.
+  */
+  const char** include;
+  size_t include_count;
+  const char** exclude;
+  size_t exclude_count;
+  uint32_t threads;         // 0 for one per online CPU
+  bool cross_mounts;        // descend into other filesystems
+  uint32_t progress_interval;  // entries between progress calls, 0 for default
+  /* called from worker threads, never concurrently */
+  void (*progress)(const struct tree_progress* progress, void* data);
+  void (*error)(const char* path, int err, void* data);   // path relative to the root
+  void* data;
+};
+
+/*
+* @root file or directory
+* @config operation and walk parameters
+* @progress set to the final counters, may be NULL
+* apply the operation to root and, if it is a directory, to everything below
+* it. Directories are processed in parallel, entries are opened relative to
+* their directory and updated through their descriptor. Symbolic links are
+* never followed. Return 0 if every entry was updated, the number of errors
+* if some failed, or a negative errno value if the walk could not start.
+*/
+int provenance_tree_apply(const char* root, const struct tree_config* config, struct tree_progress* progress);
+
+struct process_config{
+  enum process_op op;
+  bool value;               // set or clear, ignored by PROCESS_LABEL
+  const char* label;        // PROCESS_LABEL
+  void (*result)(uint32_t pid, int err, void* data);  // 0 or errno value per pid, may be NULL
+  void* data;
+};
+
+/* what a selection predicate gets to see, read from /proc/<pid> */
+struct process_info{
+  uint32_t pid;
+  uint32_t uid;             // real uid
+  uint32_t gid;             // real gid
+  char comm[16];
+  /* namespace inode numbers, 0 if unavailable */
+  uint64_t pidns;
+  uint64_t mntns;
+  uint64_t netns;
+  uint64_t ipcns;
+  uint64_t utsns;
+  uint64_t userns;
+  uint64_t cgroupns;
+};
+
+/*
+* @cgroup cgroup as listed in /proc/<pid>/cgroup (e.g. "/system.slice"), or
+* "<controller>/<path>" on cgroup v1; both are looked up under /sys/fs/cgroup
+* @config operation to apply
+* apply the operation to every process of the cgroup and of its descendants.
+* Return the number of pids that failed or a negative errno value.
+*/
+int provenance_cgroup_apply(const char* cgroup, const struct process_config* config);
+
+/*
+* @select return true for processes the operation applies to
+* @config operation to apply, config->data is also passed to select
+* scan /proc and apply the operation to the selected processes. Processes
+* exiting during the scan are ignored. Return the number of pids that failed
+* or a negative errno value.
+*/
+int provenance_select_apply(bool (*select)(const struct process_info* info, void* data), const struct process_config* config);
+
+/*
+* @paths files to resolve
+* @count number of entries
+* @arena count*PROV_FILE_ID_LEN bytes, the "cf:" identifier of entry i is
+* written at arena + i*PROV_FILE_ID_LEN, an empty string if it failed
+* @errors set to 0 or a negative errno value per entry, may be NULL
+* @threads 0 for one per online CPU
+* resolve provenance file identifiers in parallel. Return the number of
+* entries that failed or a negative errno value.
+*/
+int provenance_file_ids(const char** paths, size_t count, char* arena, int* errors, uint32_t threads);
+int fprovenance_file_ids(const int* fds, size_t count, char* arena, int* errors, uint32_t threads);
+
+#endif /* __PROVENANCEBULK_H */
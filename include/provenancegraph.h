@@ -0,0 +1,110 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCEGRAPH_H
+#define __PROVENANCEGRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/provenance.h>
+
+/*
+* In-memory provenance graph. Nodes are keyed on (id, boot_id): every version
+* of an object is the same node, which keeps its type and latest version, and
+* relations between versions of an object are dropped. Relations are stored
+* once in each direction. Once started, the relay feeds the graph with every
+* record that passes the filter.
+*
+* The memory given at start is a hard limit: nodes and relations that do not
+* fit are dropped and counted.
+*/
+struct graph_stats{
+  uint64_t nodes;
+  uint64_t edges;           // relations stored
+  uint64_t merged_edges;    // repeated relations not stored again
+  uint64_t dropped_nodes;   // node table full
+  uint64_t dropped_edges;   // edge memory exhausted, or endpoint dropped
+  uint64_t memory;          // bytes in use
+  uint64_t capacity;        // bytes reserved
+};
+
+struct graph_edge_info{
+  struct node_identifier node;  // other end, at its latest version
+  uint64_t type;                // relation type
+  uint32_t first;               // first and last time recorded (seconds)
+  uint32_t last;
+};
+
+/*
+* @memory bytes the graph may use, at least 1MB
+* Return 0, -EBUSY if already started or a negative errno value.
+*/
+int provenance_graph_start(size_t memory);
+void provenance_graph_stop(void);
+void provenance_graph_stats(struct graph_stats* stats);
+
+/* add a record, done by the relay, no-op when the graph is not started */
+void provenance_graph_record(const union prov_elt* msg);
+void provenance_graph_long_record(const union long_prov_elt* msg);
+
+/*
+* @node set to the type and latest version of the node (id, boot_id)
+* Return 0 or -ENOENT.
+*/
+int provenance_graph_node(uint64_t id, uint32_t boot_id, struct node_identifier* node);
+
+/*
+* @node node to look at, its version is ignored
+* @out outgoing (node is the sender) or incoming relations
+* @edges filled with up to count relations, most recent first
+* Return the number of relations of the node (which may exceed count) or
+* -ENOENT.
+*/
+ssize_t provenance_graph_edges(const struct node_identifier* node, bool out, struct graph_edge_info* edges, size_t count);
+
+enum lineage_direction{
+  LINEAGE_BACKWARD,   // what the node derives from, follows incoming relations
+  LINEAGE_FORWARD     // what derives from the node, follows outgoing relations
+};
+
+/*
+* Type masks are subtype bits (e.g. ENT_INODE_FILE & SUBTYPE_MASK). Relations
+* are followed only when recorded within [since, until]. Node types only
+* filter what is reported, traversal goes through every node.
+*/
+struct lineage_query{
+  enum lineage_direction direction;
+  uint32_t depth;           // maximum number of hops, 0 for unbounded
+  uint64_t node_types;      // nodes reported, 0 for all
+  uint64_t relation_types;  // relations followed, 0 for all
+  uint32_t since;           // seconds, 0 for unbounded
+  uint32_t until;           // seconds, 0 for unbounded
+  uint32_t threads;         // 0 for one per CPU
+};
+
+struct lineage_result{
+  struct node_identifier node;  // at its latest version
+  uint32_t depth;               // hops from the start node
+};
+
+/*
+* @start node to start from, its version is ignored, it is not reported
+* @results filled with up to count nodes, by increasing depth
+* Large frontiers are expanded in parallel. Recording goes on during the
+* query, relations recorded meanwhile may or may not be followed.
+* Return the number of nodes reached (which may exceed count), -ENOENT (also
+* if the graph is stopped during the query) or a negative errno value.
+*/
+ssize_t provenance_graph_lineage(const struct node_identifier* start, const struct lineage_query* query, struct lineage_result* results, size_t count);
+
+#endif /* __PROVENANCEGRAPH_H */
@@ -0,0 +1,102 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCELOG_H
+#define __PROVENANCELOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/provenance.h>
+
+/*
+* Append-only binary log of raw records, as received from the relay. Records
+* are grouped in compressed blocks; each block header carries its record
+* count, jiffies range, machine_id and the subtypes of the nodes and relations
+* it holds, so that readers can skip blocks a query cannot match. Closing the
+* log appends an index of the block headers; a log that was not closed is
+* read by walking the block headers instead.
+*
+* Records are stored in host order, the log can only be read on hosts with
+* the same byte order and kernel structures (the file header records both and
+* is checked on open, errno is EPROTO otherwise).
+*/
+#define LOG_DEFAULT_BLOCK (1024*1024)
+
+struct provenance_log;
+
+struct log_stats{
+  uint64_t blocks;
+  uint64_t records;
+  uint64_t bytes;       // written to the file
+  uint64_t raw_bytes;   // before compression
+};
+
+/*
+* @path log file, created if it does not exist, appended to otherwise
+* @block_size uncompressed bytes per block, 0 for default
+* @level zlib compression level
+* A partially written trailing block is discarded. Return NULL on error
+* (errno is set).
+*/
+struct provenance_log* provenance_log_open(const char* path, size_t block_size, int level);
+
+/* write the current block and the index, and release the log */
+void provenance_log_close(struct provenance_log* log);
+
+/* append a record, blocks are written once full. Thread safe. */
+int provenance_log_record(struct provenance_log* log, const union prov_elt* msg);
+int provenance_log_long_record(struct provenance_log* log, const union long_prov_elt* msg);
+
+/* write the current block, even if not full */
+int provenance_log_flush(struct provenance_log* log);
+
+void provenance_log_stats(struct provenance_log* log, struct log_stats* stats);
+
+struct log_reader;
+
+/*
+* @path log file, mapped in memory
+* Return NULL on error (errno is set).
+*/
+struct log_reader* provenance_log_reader_open(const char* path);
+void provenance_log_reader_close(struct log_reader* reader);
+
+/*
+* Type masks are subtype bits (e.g. ENT_INODE_FILE & SUBTYPE_MASK), a record
+* matches when its type is in either mask; when both are 0 all types match.
+*/
+struct log_query{
+  uint64_t since;           // jiffies, 0 for unbounded
+  uint64_t until;           // jiffies, 0 for unbounded
+  uint32_t machine_id;      // 0 for any
+  uint64_t node_types;
+  uint64_t relation_types;
+  void (*record)(const union prov_elt* msg, void* data);
+  void (*long_record)(const union long_prov_elt* msg, void* data);
+  void* data;
+};
+
+struct log_scan_stats{
+  uint64_t blocks;          // blocks in the log
+  uint64_t blocks_read;     // blocks that could match and were decompressed
+  uint64_t records;         // records in blocks read
+  uint64_t matched;
+};
+
+/*
+* call the query callbacks, in log order, for every record that matches.
+* Several scans may run concurrently on the same reader.
+* Return 0, -EBADMSG if a block is corrupted or a negative errno value.
+*/
+int provenance_log_scan(struct log_reader* reader, const struct log_query* query, struct log_scan_stats* stats);
+
+#endif /* __PROVENANCELOG_H */
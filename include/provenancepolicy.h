@@ -0,0 +1,66 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCEPOLICY_H
+#define __PROVENANCEPOLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+* A capture policy describes the complete desired state of the kernel
+* filters, in the camflow.ini format:
+*
+* [provenance]
+* node_filter=directory              (also relation_filter,
+* propagate_node_filter=directory     propagate_relation_filter)
+* [ipv4-ingress]                     (and [ipv4-egress])
+* track=0.0.0.0/0:80                 (also propagate, record)
+* [user]                             (and [group])
+* track=vagrant                      (also propagate, opaque)
+* [secctx]
+* opaque=system_u:object_r:bin_t:s0  (also track, propagate)
+* [cgroup]
+* track=675                          (also propagate)
+*
+* Lines starting with ';' or '#' are comments. Other sections and other keys
+* of [provenance] (machine_id, enabled...) are not filters and are ignored.
+* Filters absent from the document are removed from the kernel.
+*/
+struct capture_policy;
+
+struct policy_stats{
+  uint32_t added;       // rules not in the kernel
+  uint32_t changed;     // rules whose operation differs
+  uint32_t removed;     // kernel rules not in the policy
+  uint32_t unchanged;
+  uint32_t writes;      // control file writes issued
+};
+
+/*
+* @path policy document
+* @line set to the offending line on parse error, may be NULL
+* Return NULL on error (errno is set).
+*/
+struct capture_policy* provenance_policy_load(const char* path, int* line);
+void provenance_policy_free(struct capture_policy* policy);
+
+/*
+* @policy desired state
+* @dry_run only compute the difference
+* @stats set to the difference, may be NULL
+* read the current filters back from the kernel and write only what differs.
+* If a write fails the changes already made are reverted. Return 0 on
+* success or a negative errno value.
+*/
+int provenance_policy_apply(const struct capture_policy* policy, bool dry_run, struct policy_stats* stats);
+
+#endif /* __PROVENANCEPOLICY_H */
@@ -0,0 +1,125 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#ifndef __PROVENANCESINK_H
+#define __PROVENANCESINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+enum sink_format{
+  SINK_PROVJSON,  // ProvJSON documents, one per line
+  SINK_NDJSON,    // one JSON value per line, embedded line breaks are removed
+  SINK_BINARY     // must be compressed frames (compress_stream_frame), written as is
+};
+
+struct provenance_sink;
+
+struct sink_stats{
+  uint64_t batches;           // batches accepted
+  uint64_t bytes;
+  uint64_t blocked;           // times a writer waited for room
+  uint64_t dropped_batches;
+  uint64_t dropped_bytes;
+  uint64_t spilled_batches;   // batches that went through the spill file
+  uint64_t spilled_bytes;
+  uint64_t reconnections;
+};
+
+struct sink_ops{
+  /* write one batch, called with the sink lock held */
+  int (*write)(struct provenance_sink* sink, const void* data, size_t length);
+  /* push buffered data to its destination, called with the sink lock held */
+  int (*flush)(struct provenance_sink* sink);
+  /* flush and release resources, called once when no other call is in progress */
+  void (*close)(struct provenance_sink* sink);
+};
+
+struct provenance_sink{
+  const struct sink_ops* ops;
+  enum sink_format format;
+  pthread_mutex_t lock;
+  struct sink_stats stats;    // protected by lock
+  void* priv;
+};
+
+/*
+* @sink sink created by one of the functions below
+* @data batch to write
+* @length size of the batch in bytes
+* write a batch to the sink. Thread safe. Return 0 or a negative errno value.
+*/
+int provenance_sink_write(struct provenance_sink* sink, const void* data, size_t length);
+
+/*
+* push all buffered data to the sink destination.
+*/
+int provenance_sink_flush(struct provenance_sink* sink);
+
+/*
+* flush and release the sink.
+*/
+void provenance_sink_close(struct provenance_sink* sink);
+
+/*
+* @stats filled with the sink counters
+*/
+int provenance_sink_stats(struct provenance_sink* sink, struct sink_stats* stats);
+
+#define FILE_SINK_DEFAULT_BUFFER  (4*1024*1024)
+
+struct file_sink_config{
+  const char* path;           // file being written, rotated files get a suffix
+  enum sink_format format;
+  size_t buffer_size;         // rounded to a multiple of 4096, 0 for default
+  bool direct;                // open with O_DIRECT
+  uint64_t rotate_size;       // rotate after this many bytes, 0 never
+  uint32_t rotate_interval;   // rotate every rotate_interval seconds, 0 never
+  uint32_t sync_interval;     // data is made durable every sync_interval ms, 0 never
+};
+
+/*
+* @config sink configuration
+* create a sink writing batches to a file through a large aligned buffer.
+* On rotation the current file is renamed path.<seconds>.<sequence> and a new
+* file is created. When direct is set, only whole blocks are written before
+* rotation or close. Return NULL on error (errno is set).
+*/
+struct provenance_sink* provenance_file_sink(const struct file_sink_config* config);
+
+enum sink_backpressure{
+  SINK_BLOCK,   // writers wait for the peer
+  SINK_SPILL,   // batches go to spill_path and are replayed in order
+  SINK_DROP     // batches are dropped and counted
+};
+
+#define SOCKET_SINK_DEFAULT_QUEUE (16*1024*1024)
+
+struct socket_sink_config{
+  const char* address;        // UNIX socket path ('@' for abstract) or "ip:port", "[ipv6]:port"
+  enum sink_format format;
+  size_t queue_size;          // bytes held in memory before backpressure applies, 0 for default
+  enum sink_backpressure policy;
+  const char* spill_path;     // used by SINK_SPILL
+};
+
+/*
+* @config sink configuration
+* create a sink streaming batches to a local collector. Writers only queue
+* batches, a sender thread coalesces them into non-blocking gather writes and
+* reconnects when the peer goes away. Batches still queued on close are
+* dropped if the peer cannot be reached. Return NULL on error (errno is set).
+*/
+struct provenance_sink* provenance_socket_sink(const struct socket_sink_config* config);
+
+#endif /* __PROVENANCESINK_H */
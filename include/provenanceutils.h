@@ -26,7 +26,38 @@ int base64encode(const void* data_buf, size_t dataLength, char* result, size_t r
 #define compress64encodeBound(in) encode64Bound(compressBound(in))
 int compress64encode(const char* in, size_t inlen, char* out, size_t outlen);
 
+/*
+* A compressed frame is an 8 bytes header (compressed and original length,
+* both big endian uint32_t) followed by a complete zlib stream. Frames can be
+* decoded independently of each others.
+*/
+#define COMPRESS_FRAME_HEADER_LENGTH (2*sizeof(uint32_t))
+#define compressFrameBound(in) (COMPRESS_FRAME_HEADER_LENGTH+compressBound(in))
+
+struct compress_stream{
+  z_stream strm;
+  uint8_t* out;
+  size_t out_size;
+  int level;
+};
+
+int compress_stream_init(struct compress_stream* s, int level);
+int compress_stream_frame(struct compress_stream* s, const void* in, size_t inlen, uint8_t** frame, size_t* framelen);
+void compress_stream_end(struct compress_stream* s);
+int decompress_frame(const uint8_t* frame, size_t framelen, char** out, size_t* outlen);
+
+/*
+* @out destination buffer, always null terminated
+* @in string to escape, stops at inlen or at the first null byte
+* write in as the content of a JSON string in a single pass, escaping quotes,
+* backslashes and control characters. Escape sequences are never truncated.
+* Return the number of bytes written (excluding the terminating null byte).
+*/
+#define jsonEscapeBound(in) (in*6+1)
+size_t json_escape(char* out, size_t outlen, const char* in, size_t inlen);
+
 #define PROV_ID_STR_LEN encode64Bound(PROV_IDENTIFIER_BUFFER_LENGTH)
+#define PROV_FILE_ID_LEN (PROV_ID_STR_LEN+3) // "cf:" prefix
 #define ID_ENCODE base64encode
 #define TAINT_ENCODE hexify
 #define TAINT_STR_LEN hexifyBound(PROV_N_BYTES)
@@ -53,6 +84,36 @@ static inline const char* uint32_to_ipv4str(uint32_t v){
   return __addr;
 }
 
+/*
+* Asynchronous reverse DNS cache, see provenanceresolver.c
+* @ttl number of seconds a resolution (positive or negative) is kept
+* @fcn resolver to use, NULL for getnameinfo. Must return 0 on success.
+*/
+typedef int (*resolver_fcn)(const struct sockaddr* addr, socklen_t length, char* host, size_t hostlen);
+int provenance_resolver_start(uint32_t ttl, resolver_fcn fcn);
+void provenance_resolver_stop(void);
+/*
+* never blocks, return 0 and fill host if a valid resolution is cached,
+* otherwise queue the address for resolution and return a negative value.
+*/
+int provenance_resolver_lookup(const struct sockaddr* addr, socklen_t length, char* host, size_t hostlen);
+
+/*
+* inode to path cache, see provenancepath.c. Learnt by the relay from
+* ENT_FILE_NAME records and RL_NAMED relations.
+* @memory upper bound on the memory used by the cache, in bytes
+*/
+int provenance_path_cache_start(size_t memory);
+void provenance_path_cache_stop(void);
+void provenance_path_cache_name(const struct file_name_struct* name);
+void provenance_path_cache_named(const struct relation_struct* relation);
+/*
+* @inode identifier of any version of the inode
+* return 0 and fill path with the last name seen for the inode, -ENOENT
+* otherwise.
+*/
+int provenance_path_cache_lookup(const union prov_identifier* inode, char* path, size_t pathlen);
+
 union mask{
   uint32_t value;
   uint8_t buffer[4];
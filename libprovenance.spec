@@ -20,6 +20,12 @@ cp -f %{SOURCEURL0}/include/provenance.h ./usr/include/provenance.h
 cp -f %{SOURCEURL0}/include/provenancefilter.h ./usr/include/provenancefilter.h
 cp -f %{SOURCEURL0}/include/provenanceutils.h ./usr/include/provenanceutils.h
 cp -f %{SOURCEURL0}/include/provenanceProvJSON.h ./usr/include/provenanceProvJSON.h
+cp -f %{SOURCEURL0}/include/provenancesink.h ./usr/include/provenancesink.h
+cp -f %{SOURCEURL0}/include/provenanceblob.h ./usr/include/provenanceblob.h
+cp -f %{SOURCEURL0}/include/provenancebulk.h ./usr/include/provenancebulk.h
+cp -f %{SOURCEURL0}/include/provenancepolicy.h ./usr/include/provenancepolicy.h
+cp -f %{SOURCEURL0}/include/provenancegraph.h ./usr/include/provenancegraph.h
+cp -f %{SOURCEURL0}/include/provenancelog.h ./usr/include/provenancelog.h
 
 %clean
 rm -r -f "$RPM_BUILD_ROOT"
@@ -31,5 +37,11 @@ rm -r -f "$RPM_BUILD_ROOT"
 /usr/include/provenancefilter.h
 /usr/include/provenanceutils.h
 /usr/include/provenanceProvJSON.h
+/usr/include/provenancesink.h
+/usr/include/provenanceblob.h
+/usr/include/provenancebulk.h
+/usr/include/provenancepolicy.h
+/usr/include/provenancegraph.h
+/usr/include/provenancelog.h
 
 %post -p /sbin/ldconfig
@@ -12,6 +12,8 @@
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
@@ -22,27 +24,210 @@
 #include <linux/xattr.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 #include <linux/provenance_types.h>
 
 #include "provenance.h"
 #include "provenanceutils.h"
-#include "uthash.h"
 
-static inline int __set_boolean(bool value, const char* name){
-  int rc;
-  int fd = open(name, O_WRONLY);
+/*
+* securityfs control files are opened once (per access mode) and kept open,
+* calls then cost a single pread/pwrite at offset 0. Descriptors are looked
+* up by path in a small open addressing table, slots are never removed. The
+* table lock is only taken to insert a path or open a descriptor. A forked
+* child drops the inherited descriptors: access is checked at open time and
+* the child may run with different credentials. The file identity is kept:
+* if the application closed the descriptor and the number was reused, writes
+* (checked before every call) and failed reads reopen the control file
+* instead of touching an unrelated file.
+*/
+#define CONTROL_SLOTS 64
 
-  if(fd<0)
-  {
+struct control_file {
+  const char* path;
+  int fd[2]; /* read, write: descriptor+1, 0 when not open */
+  dev_t dev[2]; /* identity of the file opened, set before fd */
+  ino_t ino[2];
+};
+
+static struct control_file control_files[CONTROL_SLOTS];
+static pthread_mutex_t l_control = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t control_once = PTHREAD_ONCE_INIT;
+
+static void __control_drop(void){
+  int i;
+  int j;
+  int fd;
+
+  for(i = 0; i < CONTROL_SLOTS; i++){
+    for(j = 0; j < 2; j++){
+      fd = __atomic_exchange_n(&control_files[i].fd[j], 0, __ATOMIC_ACQ_REL);
+      if(fd > 0)
+        close(fd-1);
+    }
+  }
+}
+
+static void __control_atfork_child(void){
+  pthread_mutex_init(&l_control, NULL); // may have been held by another thread
+  __control_drop();
+}
+
+static void __control_init(void){
+  pthread_atfork(NULL, NULL, __control_atfork_child);
+}
+
+static inline uint32_t __control_hash(const char* path){
+  uint32_t h = 2166136261U;
+
+  while(*path){
+    h ^= (uint8_t)*path++;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static struct control_file* __control_find(const char* path){
+  uint32_t i = __control_hash(path);
+  uint32_t n;
+  const char* p;
+  char* copy;
+
+  for(n = 0; n < CONTROL_SLOTS; n++, i++){
+    p = __atomic_load_n(&control_files[i % CONTROL_SLOTS].path, __ATOMIC_ACQUIRE);
+    if(p == NULL)
+      break;
+    if(p == path || strcmp(p, path) == 0)
+      return &control_files[i % CONTROL_SLOTS];
+  }
+  if(n == CONTROL_SLOTS)
+    return NULL;
+  copy = strdup(path);
+  if(copy == NULL)
+    return NULL;
+  pthread_mutex_lock(&l_control);
+  for(; n < CONTROL_SLOTS; n++, i++){ // someone may have inserted meanwhile
+    p = control_files[i % CONTROL_SLOTS].path;
+    if(p == NULL){
+      __atomic_store_n(&control_files[i % CONTROL_SLOTS].path, copy, __ATOMIC_RELEASE);
+      copy = NULL;
+      break;
+    }
+    if(strcmp(p, path) == 0)
+      break;
+  }
+  pthread_mutex_unlock(&l_control);
+  free(copy);
+  return (n == CONTROL_SLOTS) ? NULL : &control_files[i % CONTROL_SLOTS];
+}
+
+/* return a descriptor or -1 (errno set) */
+static int __control_fd(struct control_file* c, int w){
+  int fd = __atomic_load_n(&c->fd[w], __ATOMIC_ACQUIRE) - 1;
+  struct stat st;
+
+  if(fd >= 0)
     return fd;
+  pthread_mutex_lock(&l_control);
+  fd = c->fd[w] - 1;
+  if(fd < 0){
+    fd = open(c->path, (w ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+    if(fd >= 0){
+      if(fstat(fd, &st) == 0){
+        c->dev[w] = st.st_dev;
+        c->ino[w] = st.st_ino;
+        __atomic_store_n(&c->fd[w], fd + 1, __ATOMIC_RELEASE);
+      }else{
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  pthread_mutex_unlock(&l_control);
+  return fd;
+}
+
+/* is fd still the control file we opened, errno is preserved */
+static inline bool __control_valid(const struct control_file* c, int w, int fd){
+  struct stat st;
+  int err = errno;
+  bool rc;
+
+  rc = fstat(fd, &st) == 0 && st.st_dev == c->dev[w] && st.st_ino == c->ino[w];
+  errno = err;
+  return rc;
+}
+
+/* the descriptor was closed behind our back, forget it (it may not be ours to close) */
+static inline void __control_invalidate(struct control_file* c, int w, int fd){
+  int expected = fd + 1;
+
+  __atomic_compare_exchange_n(&c->fd[w], &expected, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static ssize_t __control_iov(const char* path, const struct iovec* iov, int iovcnt, int w){
+  struct control_file* c;
+  ssize_t rc;
+  int retry = 1;
+  int fd;
+
+  pthread_once(&control_once, __control_init);
+  c = __control_find(path);
+  if(c == NULL){ // table full, fall back to a transient descriptor
+    fd = open(path, (w ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+    if(fd < 0)
+      return fd;
+    rc = w ? pwritev(fd, iov, iovcnt, 0) : preadv(fd, iov, iovcnt, 0);
+    close(fd);
+    return rc;
   }
+  do{
+    fd = __control_fd(c, w);
+    if(fd < 0)
+      return fd;
+    if(w && !__control_valid(c, w, fd)){ // never write into a file that reused the number
+      __control_invalidate(c, w, fd);
+      rc = -1;
+      errno = EBADF;
+      continue;
+    }
+    rc = w ? pwritev(fd, iov, iovcnt, 0) : preadv(fd, iov, iovcnt, 0);
+    if(rc >= 0 || (errno != EBADF && errno != EINVAL) || __control_valid(c, w, fd))
+      break; // success or an error from the control file itself
+    __control_invalidate(c, w, fd);
+  }while(retry--);
+  return rc;
+}
+
+static inline ssize_t __control_io(const char* path, void* buf, size_t length, int w){
+  struct iovec iov;
+
+  iov.iov_base = buf;
+  iov.iov_len = length;
+  return __control_iov(path, &iov, 1, w);
+}
+
+ssize_t provenance_control_read(const char* path, void* buf, size_t length){
+  return __control_io(path, buf, length, 0);
+}
+
+ssize_t provenance_control_write(const char* path, const void* buf, size_t length){
+  return __control_io(path, (void*)buf, length, 1);
+}
+
+void provenance_control_close(void){
+  __control_drop();
+}
+
+static inline int __set_boolean(bool value, const char* name){
+  int rc;
+
   if(value)
   {
-    rc = write(fd, "1", sizeof(char));
+    rc = provenance_control_write(name, "1", sizeof(char));
   }else{
-    rc = write(fd, "0", sizeof(char));
+    rc = provenance_control_write(name, "0", sizeof(char));
   }
-  close(fd);
   if(rc < 0){
     return rc;
   }
@@ -50,17 +235,11 @@ static inline int __set_boolean(bool value, const char* name){
 }
 
 static inline bool __get_boolean(const char* name){
-  int fd = open(name, O_RDONLY);
   int rc;
   char c;
-  if(fd<0)
-  {
-    return false;
-  }
 
-  rc = read(fd, &c, sizeof(char));
-  close(fd);
-  if( rc<0 ){
+  rc = provenance_control_read(name, &c, sizeof(char));
+  if( rc<=0 ){
     return false;
   }
   return c!='0';
@@ -84,10 +263,6 @@ declare_get_boolean_fcn(provenance_does_compress_edge, PROV_COMPRESS_EDGE_FILE);
 #define declare_self_set_flag(fcn_name, element, operation) int fcn_name (bool v){ \
   struct prov_process_config cfg;\
   int rc;\
-  int fd = open(PROV_SELF_FILE, O_WRONLY);\
-  if( fd < 0 ){\
-    return fd;\
-  }\
   memset(&cfg, 0, sizeof(struct prov_process_config));\
   cfg.op=operation;\
   if(v){\
@@ -95,8 +270,7 @@ declare_get_boolean_fcn(provenance_does_compress_edge, PROV_COMPRESS_EDGE_FILE);
   }else{\
     prov_clear_flag(&cfg.prov, element);\
   }\
-  rc = write(fd, &cfg, sizeof(struct prov_process_config));\
-  close(fd);\
+  rc = provenance_control_write(PROV_SELF_FILE, &cfg, sizeof(struct prov_process_config));\
   if(rc>0) rc=0;\
   return rc;\
 }
@@ -126,12 +300,8 @@ int provenance_set_propagate(bool v){
 
 int provenance_set_machine_id(uint32_t v){
   int rc;
-  int fd = open(PROV_MACHINE_ID_FILE, O_WRONLY);
 
-  if(fd<0)
-    return fd;
-  rc = write(fd, &v, sizeof(uint32_t));
-  close(fd);
+  rc = provenance_control_write(PROV_MACHINE_ID_FILE, &v, sizeof(uint32_t));
   if(rc<0)
     return rc;
   return 0;
@@ -139,12 +309,8 @@ int provenance_set_machine_id(uint32_t v){
 
 int provenance_get_machine_id(uint32_t* v){
   int rc;
-  int fd = open(PROV_MACHINE_ID_FILE, O_RDONLY);
 
-  if(fd<0)
-    return fd;
-  rc = read(fd, v, sizeof(uint32_t));
-  close(fd);
+  rc = provenance_control_read(PROV_MACHINE_ID_FILE, v, sizeof(uint32_t));
   if(rc<0)
     return rc;
   return 0;
@@ -152,12 +318,8 @@ int provenance_get_machine_id(uint32_t* v){
 
 int provenance_set_boot_id(uint32_t v){
   int rc;
-  int fd = open(PROV_BOOT_ID_FILE, O_WRONLY);
 
-  if(fd<0)
-    return fd;
-  rc = write(fd, &v, sizeof(uint32_t));
-  close(fd);
+  rc = provenance_control_write(PROV_BOOT_ID_FILE, &v, sizeof(uint32_t));
   if(rc<0)
     return rc;
   return 0;
@@ -165,48 +327,65 @@ int provenance_set_boot_id(uint32_t v){
 
 int provenance_get_boot_id(uint32_t* v){
   int rc;
-  int fd = open(PROV_BOOT_ID_FILE, O_RDONLY);
 
-  if(fd<0)
-    return fd;
-  rc = read(fd, v, sizeof(uint32_t));
-  close(fd);
+  rc = provenance_control_read(PROV_BOOT_ID_FILE, v, sizeof(uint32_t));
   if(rc<0)
     return rc;
   return 0;
 }
 
 int provenance_disclose_node(struct disc_node_struct* node){
-  int rc;
-  int fd = open(PROV_NODE_FILE, O_WRONLY);
-
-  if(fd<0)
-    return fd;
-  rc = write(fd, node, sizeof(struct disc_node_struct));
-  close(fd);
-  return rc;
+  return provenance_control_write(PROV_NODE_FILE, node, sizeof(struct disc_node_struct));
 }
 
 int provenance_disclose_relation(struct relation_struct* relation){
-  int rc;
-  int fd = open(PROV_RELATION_FILE, O_WRONLY);
+  return provenance_control_write(PROV_RELATION_FILE, relation, sizeof(struct relation_struct));
+}
 
-  if(fd<0)
-    return fd;
-  rc = write(fd, relation, sizeof(struct relation_struct));
-  close(fd);
-  return rc;
+/*
+* securityfs has no write_iter, the kernel calls the write handler once per
+* iovec: every element is disclosed and gets its identifier back in place,
+* DISCLOSE_BATCH elements per syscall.
+*/
+#define DISCLOSE_BATCH 1024 // UIO_MAXIOV
+
+static int __disclose_batch(const char* path, uint8_t* elts, size_t size, size_t count){
+  struct iovec iov[DISCLOSE_BATCH];
+  size_t done = 0;
+  size_t n;
+  size_t i;
+  ssize_t rc;
+
+  while(done < count){
+    n = count - done;
+    if(n > DISCLOSE_BATCH)
+      n = DISCLOSE_BATCH;
+    for(i = 0; i < n; i++){
+      iov[i].iov_base = elts + (done + i)*size;
+      iov[i].iov_len = size;
+    }
+    rc = __control_iov(path, iov, n, 1);
+    if(rc < 0)
+      return (done > 0) ? (int)done : rc;
+    if((size_t)rc < size) // first element refused
+      return (done > 0) ? (int)done : -EINVAL;
+    done += rc/size;
+    if((size_t)rc < n*size) // stopped on an element, report what went through
+      break;
+  }
+  return done;
 }
 
-int provenance_self(struct task_prov_struct* self){
-  int rc;
-  int fd = open(PROV_SELF_FILE, O_RDONLY);
+int provenance_disclose_nodes(struct disc_node_struct* nodes, size_t count){
+  return __disclose_batch(PROV_NODE_FILE, (uint8_t*)nodes, sizeof(struct disc_node_struct), count);
+}
 
-  if(fd<0)
-    return fd;
-  rc = read(fd, self, sizeof(struct task_prov_struct));
-  close(fd);
-  return rc;
+int provenance_disclose_relations(struct relation_struct* relations, size_t count){
+  return __disclose_batch(PROV_RELATION_FILE, (uint8_t*)relations, sizeof(struct relation_struct), count);
+}
+
+int provenance_self(struct task_prov_struct* self){
+  return provenance_control_read(PROV_SELF_FILE, self, sizeof(struct task_prov_struct));
 }
 
 bool provenance_is_present(void){
@@ -217,36 +396,33 @@ bool provenance_is_present(void){
 
 int provenance_flush(void){
   char tmp = 1;
-  int rc;
-  int fd = open(PROV_FLUSH_FILE, O_WRONLY);
 
-  if(fd<0)
-    return fd;
-  rc = write(fd, &tmp, sizeof(char));
-  close(fd);
-  return rc;
+  return provenance_control_write(PROV_FLUSH_FILE, &tmp, sizeof(char));
 }
 
 int provenance_read_file(const char path[PATH_MAX], union prov_elt* inode_info){
   return getxattr(path, XATTR_NAME_PROVENANCE, inode_info, sizeof(union prov_elt));
 }
 
+/* "cf:" followed by the encoded identifier, always PROV_FILE_ID_LEN bytes */
+static inline int __file_id(union prov_elt* inode_info, char* buff){
+  memcpy(buff, "cf:", 3);
+  if(ID_ENCODE(prov_id_buffer(inode_info), PROV_IDENTIFIER_BUFFER_LENGTH, buff + 3, PROV_ID_STR_LEN) != 0)
+    return -EINVAL;
+  return 0;
+}
+
 int provenance_file_id(const char path[PATH_MAX], char* buff, size_t len){
   int rc;
   union prov_elt inode_info;
-  char id[PROV_ID_STR_LEN];
 
-  if(len < PROV_ID_STR_LEN)
+  if(len < PROV_FILE_ID_LEN)
     return -ENOMEM;
 
   rc = getxattr(path, XATTR_NAME_PROVENANCE, &inode_info, sizeof(union prov_elt));
   if(rc < 0)
     return rc;
-    rc = ID_ENCODE(prov_id_buffer(&inode_info), PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN);
-    if (rc < 0)
-      return rc;
-    sprintf(buff, "cf:%s", id);
-    return 0;
+  return __file_id(&inode_info, buff);
 }
 
 int fprovenance_read_file(int fd, union prov_elt* inode_info){
@@ -256,19 +432,14 @@ int fprovenance_read_file(int fd, union prov_elt* inode_info){
 int fprovenance_file_id(int fd, char* buff, size_t len){
   int rc;
   union prov_elt inode_info;
-  char id[PROV_ID_STR_LEN];
 
-  if(len < PROV_ID_STR_LEN+3)
+  if(len < PROV_FILE_ID_LEN)
     return -ENOMEM;
 
   rc = fgetxattr(fd, XATTR_NAME_PROVENANCE, &inode_info, sizeof(union prov_elt));
   if (rc < 0)
     return rc;
-  rc = ID_ENCODE(prov_id_buffer(&inode_info), PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN);
-  if (rc < 0)
-    return rc;
-  sprintf(buff, "cf:%s", id);
-  return 0;
+  return __file_id(&inode_info, buff);
 }
 
 static inline int __provenance_write_file(const char path[PATH_MAX], union prov_elt* inode_info){
@@ -362,41 +533,26 @@ int fprovenance_label_file(int fd, const char *label){
 int provenance_label(const char *label){
   struct prov_process_config cfg;
   uint64_t taint = generate_label(label);
-  int rc;
-  int fd = open(PROV_SELF_FILE, O_WRONLY);
-  if( fd < 0 )
-    return fd;
+
   memset(&cfg, 0, sizeof(struct prov_process_config));
   cfg.op=PROV_SET_TAINT;
   prov_bloom_add(prov_taint(&(cfg.prov)), taint);
-
-  rc = write(fd, &cfg, sizeof(struct prov_process_config));
-  close(fd);
-  return rc;
+  return provenance_control_write(PROV_SELF_FILE, &cfg, sizeof(struct prov_process_config));
 }
 
 int provenance_read_process(uint32_t pid, union prov_elt* process_info){
   struct prov_process_config cfg;
   int rc;
-  int fd = open(PROV_PROCESS_FILE, O_RDONLY);
 
-  if( fd < 0 )
-    return fd;
   cfg.vpid = pid;
-
-  rc = read(fd, &cfg, sizeof(struct prov_process_config));
-  close(fd);
+  rc = provenance_control_read(PROV_PROCESS_FILE, &cfg, sizeof(struct prov_process_config));
   memcpy(process_info, &(cfg.prov), sizeof(union prov_elt));
   return rc;
 }
 
 #define declare_set_process_fcn(fcn_name, element, operation) int fcn_name (uint32_t pid, bool v){\
     struct prov_process_config cfg;\
-    int rc;\
-    int fd = open(PROV_PROCESS_FILE, O_WRONLY);\
-    if( fd < 0 ){\
-      return fd;\
-    }\
+    memset(&cfg, 0, sizeof(struct prov_process_config));\
     cfg.vpid = pid;\
     cfg.op=operation;\
     if(v){\
@@ -404,9 +560,7 @@ int provenance_read_process(uint32_t pid, union prov_elt* process_info){
     }else{\
       prov_clear_flag(&cfg.prov, element);\
     }\
-    rc = write(fd, &cfg, sizeof(struct prov_process_config));\
-    close(fd);\
-    return rc;\
+    return provenance_control_write(PROV_PROCESS_FILE, &cfg, sizeof(struct prov_process_config));\
   }
 
 declare_set_process_fcn(provenance_track_process, TRACKED_BIT, PROV_SET_TRACKED);
@@ -424,18 +578,119 @@ int provenance_propagate_process(uint32_t pid, bool propagate){
 int provenance_label_process(uint32_t pid, const char *label){
   struct prov_process_config cfg;
   uint64_t taint = generate_label(label);
-  int rc;
-  int fd = open(PROV_PROCESS_FILE, O_WRONLY);
-  if( fd < 0 )
-    return fd;
+
   memset(&cfg, 0, sizeof(struct prov_process_config));
   cfg.vpid=pid;
   cfg.op=PROV_SET_TAINT;
   prov_bloom_add(prov_taint(&(cfg.prov)), taint);
+  return provenance_control_write(PROV_PROCESS_FILE, &cfg, sizeof(struct prov_process_config));
+}
 
-  rc = write(fd, &cfg, sizeof(struct prov_process_config));
-  close(fd);
-  return rc;
+/*
+* As for disclosure, one pwritev hands PROCESS_BATCH configurations to the
+* kernel. It stops on the first refused pid: that one is written alone to
+* get its error and the batch resumes after it.
+*/
+#define PROCESS_BATCH 256
+
+static void __process_config(struct prov_process_config* cfg, uint32_t pid, enum process_op op, bool v, uint64_t taint){
+  memset(cfg, 0, sizeof(struct prov_process_config));
+  cfg->vpid = pid;
+  switch(op){
+    case PROCESS_TRACK:
+      cfg->op = PROV_SET_TRACKED;
+      if(v)
+        prov_set_flag(&cfg->prov, TRACKED_BIT);
+      break;
+    case PROCESS_OPAQUE:
+      cfg->op = PROV_SET_OPAQUE;
+      if(v)
+        prov_set_flag(&cfg->prov, OPAQUE_BIT);
+      break;
+    case PROCESS_PROPAGATE:
+      cfg->op = PROV_SET_PROPAGATE;
+      if(v)
+        prov_set_flag(&cfg->prov, PROPAGATE_BIT);
+      break;
+    case PROCESS_LABEL:
+      cfg->op = PROV_SET_TAINT;
+      prov_bloom_add(prov_taint(&(cfg->prov)), taint);
+      break;
+  }
+}
+
+static void __process_write(struct prov_process_config* cfg, size_t count, int* status){
+  struct iovec iov[PROCESS_BATCH];
+  size_t done = 0;
+  size_t i;
+  ssize_t rc;
+
+  for(i = 0; i < count; i++){
+    iov[i].iov_base = &cfg[i];
+    iov[i].iov_len = sizeof(struct prov_process_config);
+  }
+  while(done < count){
+    rc = __control_iov(PROV_PROCESS_FILE, &iov[done], count - done, 1);
+    if(rc < 0){
+      status[done++] = -errno;
+      continue;
+    }
+    if(rc == 0){
+      status[done++] = -EIO;
+      continue;
+    }
+    for(i = 0; i < (size_t)rc/sizeof(struct prov_process_config); i++)
+      status[done++] = 0;
+  }
+}
+
+int provenance_processes_apply(const uint32_t* pids, size_t count, enum process_op op, bool value, const char* label, int* results){
+  struct prov_process_config* cfg;
+  int status[PROCESS_BATCH];
+  int tracked[PROCESS_BATCH];
+  size_t map[PROCESS_BATCH];
+  uint64_t taint = 0;
+  int errors = 0;
+  size_t done;
+  size_t n;
+  size_t m;
+  size_t i;
+
+  if(op == PROCESS_LABEL){
+    if(label == NULL)
+      return -EINVAL;
+    taint = generate_label(label);
+  }
+  cfg = calloc(PROCESS_BATCH, sizeof(struct prov_process_config));
+  if(cfg == NULL)
+    return -ENOMEM;
+  for(done = 0; done < count; done += n){
+    n = count - done;
+    if(n > PROCESS_BATCH)
+      n = PROCESS_BATCH;
+    for(i = 0; i < n; i++)
+      __process_config(&cfg[i], pids[done + i], op, value, taint);
+    __process_write(cfg, n, status);
+    if(op == PROCESS_PROPAGATE){ // as provenance_propagate_process, also set tracking
+      for(i = 0, m = 0; i < n; i++){
+        if(status[i] < 0)
+          continue;
+        __process_config(&cfg[m], pids[done + i], PROCESS_TRACK, value, 0);
+        map[m++] = i;
+      }
+      __process_write(cfg, m, tracked);
+      for(i = 0; i < m; i++)
+        status[map[i]] = tracked[i];
+    }
+    for(i = 0; i < n; i++){
+      if(status[i] < 0)
+        errors++;
+      if(results != NULL)
+        results[done + i] = status[i];
+    }
+  }
+  free(cfg);
+  return errors;
 }
 
 union ipaddr{
@@ -474,32 +729,23 @@ static int __param_to_ipv4_filter(const char* param, struct prov_ipv4_filter* fi
   return 0;
 }
 
+int provenance_ipv4_filter_parse(const char* param, struct prov_ipv4_filter* filter){
+  return __param_to_ipv4_filter(param, filter);
+}
+
 #define declare_set_ipv4_fcn(fcn_name, file, operation) int fcn_name (const char* param){\
   struct prov_ipv4_filter filter;\
   int rc;\
-  int fd = open(file, O_WRONLY);\
-  if( fd < 0 ){\
-    return fd;\
-  }\
   rc = __param_to_ipv4_filter(param, &filter);\
   if(rc!=0){\
     return rc;\
   }\
   filter.op = operation;\
-  rc = write(fd, &filter, sizeof(struct prov_ipv4_filter));\
-  close(fd);\
-  return rc;\
+  return provenance_control_write(file, &filter, sizeof(struct prov_ipv4_filter));\
 }
 
 #define declare_get_ipv4_fcn(fcn_name, file) int fcn_name ( struct prov_ipv4_filter* filters, size_t length ){\
-  int rc;\
-  int fd = open(file, O_RDONLY);\
-  if( fd < 0 ){\
-    return fd;\
-  }\
-  rc = read(fd, filters, length);\
-  close(fd);\
-  return rc;\
+  return provenance_control_read(file, filters, length);\
 }
 
 declare_set_ipv4_fcn(provenance_ingress_ipv4_track, PROV_IPV4_INGRESS_FILE, PROV_SET_TRACKED);
@@ -515,119 +761,324 @@ declare_set_ipv4_fcn(provenance_egress_ipv4_delete, PROV_IPV4_EGRESS_FILE, PROV_
 declare_get_ipv4_fcn(provenance_ingress_ipv4, PROV_IPV4_INGRESS_FILE);
 declare_get_ipv4_fcn(provenance_egress_ipv4, PROV_IPV4_EGRESS_FILE);
 
-struct secentry {
-    int id;            /* we'll use this field as the key */
-    char name[200];
-    UT_hash_handle hh; /* makes this structure hashable */
+/*
+* Process-wide secctx cache. The cache is set associative, each slot being
+* protected by a sequence counter: lookups never take a lock, fills take the
+* lock of the shard owning the set and evict in round robin.
+*/
+#define SECCTX_CACHE_WAYS         4
+#define SECCTX_CACHE_SHARDS       16
+#define SECCTX_CACHE_DEFAULT_SIZE (256*1024)
+#define SECCTX_SLOT_LEN           256
+
+struct secctx_slot {
+  uint32_t seq; /* odd while being written, 0 if never used */
+  uint32_t secid;
+  uint32_t len;
+  char secctx[SECCTX_SLOT_LEN - 3*sizeof(uint32_t)];
 };
 
-static __thread struct secentry *hash = NULL;
+static struct secctx_slot *secctx_slots = NULL;
+static uint8_t *secctx_victims = NULL;
+static uint32_t secctx_sets = 0;
+static size_t secctx_cache_bytes = SECCTX_CACHE_DEFAULT_SIZE;
+static pthread_mutex_t secctx_locks[SECCTX_CACHE_SHARDS];
+static pthread_once_t secctx_once = PTHREAD_ONCE_INIT;
+
+static void __secctx_cache_init(void){
+  uint32_t sets = 1;
+  int i;
+
+  while( (sets * 2) * SECCTX_CACHE_WAYS * sizeof(struct secctx_slot) <= secctx_cache_bytes )
+    sets *= 2;
+  secctx_slots = calloc(sets * SECCTX_CACHE_WAYS, sizeof(struct secctx_slot));
+  secctx_victims = calloc(sets, sizeof(uint8_t));
+  if(secctx_slots == NULL || secctx_victims == NULL){
+    free(secctx_slots);
+    free(secctx_victims);
+    secctx_slots = NULL;
+    secctx_victims = NULL;
+    return;
+  }
+  for(i = 0; i < SECCTX_CACHE_SHARDS; i++)
+    pthread_mutex_init(&secctx_locks[i], NULL);
+  secctx_sets = sets;
+}
 
-bool sec_exists_entry(uint32_t secid) {
-  struct secentry *se=NULL;
-  HASH_FIND_INT(hash, &secid, se);
-  if(!se)
-    return false;
-  return true;
+int provenance_secctx_cache_size(size_t bytes){
+  if(bytes < SECCTX_CACHE_WAYS * sizeof(struct secctx_slot))
+    return -EINVAL;
+  if(secctx_sets != 0) // cache already in use
+    return -EBUSY;
+  secctx_cache_bytes = bytes;
+  return 0;
 }
 
-static void sec_add_entry(uint32_t secid, const char* secctx){
-  struct secentry *se;
-  if( sec_exists_entry(secid) )
-    return;
-  se = malloc(sizeof(struct secentry));
-  se->id=secid;
-  strncpy(se->name, secctx, 200);
-  HASH_ADD_INT(hash, id, se);
+static inline uint32_t __secctx_set(uint32_t secid){
+  secid ^= secid >> 16;
+  secid *= 0x45d9f3bU;
+  secid ^= secid >> 16;
+  return secid & (secctx_sets - 1);
 }
 
-bool sec_find_entry(uint32_t secid, char* secctx) {
-  struct secentry *se=NULL;
-  HASH_FIND_INT(hash, &secid, se);
-  if(!se)
-    return false;
-  strncpy(secctx, se->name, 200);
-  return true;
+/* return length copied, -ENOENT on miss */
+static int __secctx_cache_find(uint32_t secid, char* secctx, uint32_t len){
+  struct secctx_slot *slot;
+  uint32_t seq;
+  uint32_t l;
+  int i;
+
+  if(secctx_sets == 0)
+    return -ENOENT;
+  slot = &secctx_slots[__secctx_set(secid) * SECCTX_CACHE_WAYS];
+  for(i = 0; i < SECCTX_CACHE_WAYS; i++, slot++){
+    do{
+      seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      if(seq == 0 || (seq & 1) != 0)
+        break;
+      if(__atomic_load_n(&slot->secid, __ATOMIC_RELAXED) != secid)
+        break;
+      l = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+      if(l >= sizeof(slot->secctx))
+        break;
+      if(l >= len){
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+          return -ENOMEM;
+        continue; // len may belong to a newer entry
+      }
+      memcpy(secctx, slot->secctx, l);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq){
+        secctx[l] = '\0';
+        return l;
+      }
+    }while(1); // slot was rewritten while we were reading it
+  }
+  return -ENOENT;
+}
+
+static void __secctx_cache_add(uint32_t secid, const char* secctx){
+  struct secctx_slot *slot;
+  size_t l = strlen(secctx);
+  uint32_t set;
+  uint32_t seq;
+  int i;
+
+  if(secctx_sets == 0 || l >= sizeof(slot->secctx))
+    return; // too long to be cached, will always go to the kernel
+  set = __secctx_set(secid);
+  pthread_mutex_lock(&secctx_locks[set % SECCTX_CACHE_SHARDS]);
+  slot = &secctx_slots[set * SECCTX_CACHE_WAYS];
+  for(i = 0; i < SECCTX_CACHE_WAYS; i++){
+    if(slot[i].seq != 0 && slot[i].secid == secid) // raced with another thread
+      goto out;
+  }
+  for(i = 0; i < SECCTX_CACHE_WAYS; i++){
+    if(slot[i].seq == 0)
+      break;
+  }
+  if(i == SECCTX_CACHE_WAYS){
+    i = secctx_victims[set];
+    secctx_victims[set] = (i + 1) % SECCTX_CACHE_WAYS;
+  }
+  slot = &slot[i];
+  seq = slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&slot->secid, secid, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->len, l, __ATOMIC_RELAXED);
+  memcpy(slot->secctx, secctx, l);
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+out:
+  pthread_mutex_unlock(&secctx_locks[set % SECCTX_CACHE_SHARDS]);
 }
 
 int provenance_secid_to_secctx( uint32_t secid, char* secctx, uint32_t len){
   struct secinfo info;
   int rc;
-  int fd;
 
-  if( sec_find_entry(secid, secctx) )
+  pthread_once(&secctx_once, __secctx_cache_init);
+  rc = __secctx_cache_find(secid, secctx, len);
+  if(rc >= 0)
     return 0;
-  fd = open(PROV_SECCTX, O_RDONLY);
-  if( fd < 0 )
-    return fd;
+  if(rc != -ENOENT)
+    return rc;
   memset(&info, 0, sizeof(struct secinfo));
   info.secid=secid;
-  rc = read(fd, &info, sizeof(struct secinfo));
-  close(fd);
+  rc = provenance_control_read(PROV_SECCTX, &info, sizeof(struct secinfo));
   if(rc<0){
     secctx[0]='\0';
     return rc;
   }
-  if(len<strlen(info.secctx))
+  info.secctx[sizeof(info.secctx)-1]='\0';
+  if(len<=strlen(info.secctx))
     return -ENOMEM;
   strncpy(secctx, info.secctx, len);
-  sec_add_entry(secid, secctx);
+  __secctx_cache_add(secid, secctx);
   return rc;
 }
 
-struct typeentry {
-    uint64_t id;
-    char str[256];
-    UT_hash_handle hh; /* makes this structure hashable */
+/*
+* The type vocabulary is loaded once into process-wide read-only tables. Every
+* type carries a single subtype bit, which gives us a direct index for id to
+* string lookups. String to id lookups go through a hash-and-displace perfect
+* hash built at load time.
+*/
+#define TYPE_TABLE_SIZE     64
+#define TYPE_PHASH_SIZE     256
+#define TYPE_PHASH_BUCKETS  64
+#define TYPE_UNKNOWN_STR    "unknown"
+
+struct type_table {
+  uint64_t id[TYPE_TABLE_SIZE];
+  char* str[TYPE_TABLE_SIZE];
+  uint32_t disp[TYPE_PHASH_BUCKETS];
+  uint8_t slot[TYPE_PHASH_SIZE]; /* index+1 in id/str, 0 if empty */
 };
 
-static __thread struct typeentry *thash = NULL;
+static struct type_table node_types;
+static struct type_table relation_types;
+static pthread_once_t types_once = PTHREAD_ONCE_INIT;
+static bool types_loaded = false;
 
-bool type_exists_entry(uint64_t typeid) {
-  struct typeentry *te=NULL;
-  HASH_FIND(hh, thash, &typeid, sizeof(uint64_t), te);
-  if(!te)
-    return false;
-  return true;
+static const uint64_t node_categories[] = {DM_ACTIVITY, DM_ENTITY, DM_AGENT};
+static const uint64_t relation_categories[] = {RL_DERIVED, RL_GENERATED, RL_USED, RL_INFORMED};
+
+static inline int __type_index(uint64_t id){
+  uint64_t sub = id & SUBTYPE_MASK;
+  if(sub == 0 || (sub & (sub - 1)) != 0)
+    return -1;
+  return __builtin_ctzll(sub);
 }
 
-static void type_add_entry(uint64_t typeid, const char* name){
-  struct typeentry *te;
-  if( sec_exists_entry(typeid) )
+static inline uint32_t __type_hash(const char* str, size_t len, uint32_t seed){
+  uint32_t h = 2166136261U ^ seed;
+  size_t i;
+
+  for(i = 0; i < len; i++){
+    h ^= (uint8_t)str[i];
+    h *= 16777619U;
+  }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dU;
+  h ^= h >> 12;
+  return h;
+}
+
+static int __type_bucket_cmp(const void* a, const void* b){
+  return ((const uint8_t*)b)[1] - ((const uint8_t*)a)[1];
+}
+
+/* hash and displace: place the largest buckets first */
+static void __build_type_phash(struct type_table* t){
+  uint8_t members[TYPE_PHASH_BUCKETS][TYPE_TABLE_SIZE];
+  uint8_t order[TYPE_PHASH_BUCKETS][2]; /* bucket, size */
+  uint32_t slots[TYPE_TABLE_SIZE];
+  uint32_t b;
+  uint32_t d;
+  int i;
+  int j;
+  int k;
+  int n;
+
+  memset(order, 0, sizeof(order));
+  for(i = 0; i < TYPE_PHASH_BUCKETS; i++)
+    order[i][0] = i;
+  for(i = 0; i < TYPE_TABLE_SIZE; i++){
+    if(t->str[i] == NULL)
+      continue;
+    b = __type_hash(t->str[i], strlen(t->str[i]), 0) % TYPE_PHASH_BUCKETS;
+    members[b][order[b][1]++] = i;
+  }
+  qsort(order, TYPE_PHASH_BUCKETS, sizeof(order[0]), __type_bucket_cmp);
+
+  for(i = 0; i < TYPE_PHASH_BUCKETS && order[i][1] > 0; i++){
+    b = order[i][0];
+    n = order[i][1];
+    for(d = 1; ; d++){
+      for(j = 0; j < n; j++){
+        slots[j] = __type_hash(t->str[members[b][j]], strlen(t->str[members[b][j]]), d) % TYPE_PHASH_SIZE;
+        if(t->slot[slots[j]] != 0)
+          break;
+        for(k = 0; k < j; k++)
+          if(slots[k] == slots[j])
+            break;
+        if(k < j)
+          break;
+      }
+      if(j == n)
+        break;
+    }
+    t->disp[b] = d;
+    for(j = 0; j < n; j++)
+      t->slot[slots[j]] = members[b][j] + 1;
+  }
+}
+
+static void __load_type_table(int fd, struct type_table* t,
+                              const uint64_t* categories, size_t ncategories,
+                              uint8_t is_relation){
+  struct prov_type info;
+  uint64_t id;
+  size_t c;
+  int i;
+  int rc;
+
+  for(i = 0; i < TYPE_TABLE_SIZE; i++){
+    if( ((1ULL << i) & SUBTYPE_MASK) == 0 )
+      continue;
+    for(c = 0; c < ncategories; c++){
+      id = categories[c] | (1ULL << i);
+      memset(&info, 0, sizeof(struct prov_type));
+      info.id = id;
+      info.is_relation = is_relation;
+      rc = pread(fd, &info, sizeof(struct prov_type), 0);
+      if(rc < 0)
+        continue;
+      info.str[sizeof(info.str)-1] = '\0';
+      if(info.str[0] == '\0' || strcmp(info.str, TYPE_UNKNOWN_STR) == 0)
+        continue;
+      t->id[i] = id;
+      t->str[i] = strdup(info.str);
+      break;
+    }
+  }
+  __build_type_phash(t);
+}
+
+static void __load_types(void){
+  int fd = open(PROV_TYPE, O_RDONLY);
+
+  if( fd < 0 )
     return;
-  te = malloc(sizeof(struct typeentry));
-  te->id=typeid;
-  strncpy(te->str, name, 256);
-  HASH_ADD(hh, thash, id, sizeof(uint64_t), te);
+  __load_type_table(fd, &node_types, node_categories,
+                    sizeof(node_categories)/sizeof(uint64_t), 0);
+  __load_type_table(fd, &relation_types, relation_categories,
+                    sizeof(relation_categories)/sizeof(uint64_t), 1);
+  close(fd);
+  types_loaded = true;
 }
 
-bool type_find_entry(uint64_t typeid, char* name) {
-  struct typeentry *te=NULL;
-  HASH_FIND(hh, thash, &typeid, sizeof(uint64_t), te);
-  if(!te)
-    return false;
-  strncpy(name, te->str, 256);
-  return true;
+int provenance_load_types(void){
+  pthread_once(&types_once, __load_types);
+  if(!types_loaded)
+    return -ENOENT;
+  return 0;
 }
 
+/* slow path, only taken for types the kernel did not report at load time */
 static inline int provenance_type_id_to_str(uint64_t id,
                                 char* name,
                                 uint32_t len,
                                 uint8_t is_relation){
   struct prov_type info;
   int rc;
-  int fd;
 
-  if( type_find_entry(id, name) )
-    return 0;
-  fd = open(PROV_TYPE, O_RDONLY);
-  if( fd < 0 )
-    return fd;
   memset(&info, 0, sizeof(struct prov_type));
   info.id=id;
   info.is_relation = is_relation;
-  rc = read(fd, &info, sizeof(struct prov_type));
-  close(fd);
+  rc = provenance_control_read(PROV_TYPE, &info, sizeof(struct prov_type));
   if(rc<0){
     name[0]='\0';
     return rc;
@@ -635,21 +1086,28 @@ static inline int provenance_type_id_to_str(uint64_t id,
   if(len<strlen(info.str))
     return -ENOMEM;
   strncpy(name, info.str, len);
-  type_add_entry(id, name);
   return rc;
 }
 
 static __thread char name_buff[256];
-char* relation_id_to_str(uint64_t id){
-  int rc;
-  provenance_type_id_to_str(id, name_buff, 256, 1);
+
+static inline char* __type_id_to_str(struct type_table* t, uint64_t id, uint8_t is_relation){
+  int i;
+
+  pthread_once(&types_once, __load_types);
+  i = __type_index(id);
+  if(i >= 0 && t->id[i] == id)
+    return t->str[i];
+  provenance_type_id_to_str(id, name_buff, 256, is_relation);
   return name_buff;
 }
 
+char* relation_id_to_str(uint64_t id){
+  return __type_id_to_str(&relation_types, id, 1);
+}
+
 char* node_id_to_str(uint64_t id){
-  int rc;
-  provenance_type_id_to_str(id, name_buff, 256, 0);
-  return name_buff;
+  return __type_id_to_str(&node_types, id, 0);
 }
 
 static inline int provenance_type_str_to_id(uint64_t *id,
@@ -658,16 +1116,11 @@ static inline int provenance_type_str_to_id(uint64_t *id,
                                 uint8_t is_relation){
   struct prov_type info;
   int rc;
-  int fd;
 
-  fd = open(PROV_TYPE, O_RDONLY);
-  if( fd < 0 )
-    return fd;
   memset(&info, 0, sizeof(struct prov_type));
   strncpy(info.str, name, len);
   info.is_relation = is_relation;
-  rc = read(fd, &info, sizeof(struct prov_type));
-  close(fd);
+  rc = provenance_control_read(PROV_TYPE, &info, sizeof(struct prov_type));
   if(rc<0){
     *id = 0;
   }
@@ -675,31 +1128,35 @@ static inline int provenance_type_str_to_id(uint64_t *id,
   return rc;
 }
 
-uint64_t relation_str_to_id(const char* name, uint32_t len){
+static inline uint64_t __type_str_to_id(struct type_table* t, const char* name, uint32_t len, uint8_t is_relation){
   uint64_t id;
-  provenance_type_str_to_id(&id, name, len, 1);
+  size_t l = strnlen(name, len);
+  uint32_t b;
+  uint8_t i;
+
+  pthread_once(&types_once, __load_types);
+  b = __type_hash(name, l, 0) % TYPE_PHASH_BUCKETS;
+  i = t->slot[__type_hash(name, l, t->disp[b]) % TYPE_PHASH_SIZE];
+  if(i != 0 && strncmp(t->str[i-1], name, l) == 0 && t->str[i-1][l] == '\0')
+    return t->id[i-1];
+  provenance_type_str_to_id(&id, name, len, is_relation);
   return id;
 }
 
+uint64_t relation_str_to_id(const char* name, uint32_t len){
+  return __type_str_to_id(&relation_types, name, len, 1);
+}
+
 uint64_t node_str_to_id(const char* name, uint32_t len){
-  uint64_t id;
-  provenance_type_str_to_id(&id, name, len, 0);
-  return id;
+  return __type_str_to_id(&node_types, name, len, 0);
 }
 
 #define declare_set_secctx_fcn(fcn_name, operation) int fcn_name (const char* secctx){\
   struct secinfo filter;\
-  int rc;\
-  int fd = open(PROV_SECCTX_FILTER, O_WRONLY);\
-  if( fd < 0 ){\
-    return fd;\
-  }\
   strncpy(filter.secctx, secctx, PATH_MAX);\
   filter.len=strlen(filter.secctx);\
   filter.op = operation;\
-  rc = write(fd, &filter, sizeof(struct secinfo));\
-  close(fd);\
-  return rc;\
+  return provenance_control_write(PROV_SECCTX_FILTER, &filter, sizeof(struct secinfo));\
 }
 
 declare_set_secctx_fcn(provenance_secctx_track, PROV_SET_TRACKED);
@@ -708,39 +1165,19 @@ declare_set_secctx_fcn(provenance_secctx_opaque, PROV_SET_OPAQUE);
 declare_set_secctx_fcn(provenance_secctx_delete, PROV_SET_DELETE);
 
 int provenance_secctx( struct secinfo* filters, size_t length ){
-  int rc;
-  int fd = open(PROV_SECCTX_FILTER, O_RDONLY);
-  if( fd < 0 ){
-    return fd;
-  }
-  rc = read(fd, filters, length);
-  close(fd);
-  return rc;
+  return provenance_control_read(PROV_SECCTX_FILTER, filters, length);
 }
 
 #define declare_set_cgroup_fcn(fcn_name, operation) int fcn_name (const uint32_t cid){\
   struct nsinfo filter;\
   memset(&filter, 0, sizeof(struct nsinfo));\
-  int rc;\
-  int fd = open(PROV_NS_FILTER, O_WRONLY);\
-  if( fd < 0 ){\
-    return fd;\
-  }\
   filter.cgroupns = cid;\
   filter.op = operation;\
-  rc = write(fd, &filter, sizeof(struct nsinfo));\
-  close(fd);\
-  return rc;\
+  return provenance_control_write(PROV_NS_FILTER, &filter, sizeof(struct nsinfo));\
 }
 
 #define declare_get_ns_fcn(fcn_name) int fcn_name ( struct nsinfo* filters, size_t length ){\
-  int rc;\
-  int fd = open(PROV_NS_FILTER, O_RDONLY);\
-  if( fd < 0 )\
-    return fd;\
-  rc = read(fd, filters, length);\
-  close(fd);\
-  return rc;\
+  return provenance_control_read(PROV_NS_FILTER, filters, length);\
 }
 
 declare_set_cgroup_fcn(provenance_cgroup_track, PROV_SET_TRACKED);
@@ -750,30 +1187,18 @@ declare_set_cgroup_fcn(provenance_cgroup_delete, PROV_SET_DELETE);
 declare_get_ns_fcn(provenance_ns);
 
 int provenance_policy_hash(uint8_t* buffer, size_t length){
-  int rc;
-  int fd = open(PROV_POLICY_HASH_FILE, O_RDONLY);
-  if(fd<0)
-    return fd;
-  rc = read(fd, buffer, length);
-  close(fd);
-  return rc;
+  return provenance_control_read(PROV_POLICY_HASH_FILE, buffer, length);
 }
 
 #define declare_set_user_fcn(fcn_name, operation) int fcn_name (const char* uname){\
   struct userinfo filter;\
   struct passwd *pwd;\
-  int rc;\
-  int fd = open(PROV_UID_FILTER, O_WRONLY);\
-  if( fd < 0 )\
-    return fd;\
   pwd = getpwnam(uname);\
   if(!pwd)\
     return -EINVAL;\
   filter.uid=pwd->pw_uid;\
   filter.op = operation;\
-  rc = write(fd, &filter, sizeof(struct userinfo));\
-  close(fd);\
-  return rc;\
+  return provenance_control_write(PROV_UID_FILTER, &filter, sizeof(struct userinfo));\
 }
 
 declare_set_user_fcn(provenance_user_track, PROV_SET_TRACKED);
@@ -782,32 +1207,19 @@ declare_set_user_fcn(provenance_user_opaque, PROV_SET_OPAQUE);
 declare_set_user_fcn(provenance_user_delete, PROV_SET_DELETE);
 
 int provenance_user(struct userinfo* filters, size_t length ){
-  int rc;
-  int fd = open(PROV_UID_FILTER, O_RDONLY);
-  if( fd < 0 ){
-    return fd;
-  }
-  rc = read(fd, filters, length);
-  close(fd);
-  return rc;
+  return provenance_control_read(PROV_UID_FILTER, filters, length);
 }
 
 
 #define declare_set_group_fcn(fcn_name, operation) int fcn_name (const char* uname){\
   struct groupinfo filter;\
   struct group *gr;\
-  int rc;\
-  int fd = open(PROV_GID_FILTER, O_WRONLY);\
-  if( fd < 0 )\
-    return fd;\
   gr = getgrnam(uname);\
   if(!gr)\
     return -EINVAL;\
   filter.gid=gr->gr_gid;\
   filter.op = operation;\
-  rc = write(fd, &filter, sizeof(struct groupinfo));\
-  close(fd);\
-  return rc;\
+  return provenance_control_write(PROV_GID_FILTER, &filter, sizeof(struct groupinfo));\
 }
 
 declare_set_group_fcn(provenance_group_track, PROV_SET_TRACKED);
@@ -816,23 +1228,11 @@ declare_set_group_fcn(provenance_group_opaque, PROV_SET_OPAQUE);
 declare_set_group_fcn(provenance_group_delete, PROV_SET_DELETE);
 
 int provenance_group(struct groupinfo* filters, size_t length ){
-  int rc;
-  int fd = open(PROV_GID_FILTER, O_RDONLY);
-  if( fd < 0 )
-    return fd;
-  rc = read(fd, filters, length);
-  close(fd);
-  return rc;
+  return provenance_control_read(PROV_GID_FILTER, filters, length);
 }
 
 int provenance_version(char* version, size_t len){
-  int rc;
-  int fd = open(PROV_VERSION, O_RDONLY);
-  if( fd < 0 )
-    return fd;
-  rc = read(fd, version, len);
-  close(fd);
-  return rc;
+  return provenance_control_read(PROV_VERSION, version, len);
 }
 
 int provenance_lib_version(char* version, size_t len){
@@ -843,15 +1243,7 @@ int provenance_lib_version(char* version, size_t len){
 }
 
 int provenance_create_channel(const char name[PATH_MAX]){
-  int rc;
-  char buffer[PATH_MAX];
-
   if(strlen(name) > PATH_MAX)
     return -ENOMEM;
-  int fd = open(PROV_CHANNEL, O_WRONLY);
-  if( fd < 0 )
-    return fd;
-  rc = write(fd, name, strlen(name)+1);
-  close(fd);
-  return rc;
+  return provenance_control_write(PROV_CHANNEL, name, strlen(name)+1);
 }
@@ -17,10 +17,13 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <netdb.h>
@@ -35,6 +38,8 @@
 #include "provenance.h"
 #include "provenanceProvJSON.h"
 #include "provenanceutils.h"
+#include "provenancesink.h"
+#include "provenanceblob.h"
 
 #define MAX_PROVJSON_BUFFER_EXP     13
 #define MAX_PROVJSON_BUFFER_LENGTH  ((1 << MAX_PROVJSON_BUFFER_EXP)*sizeof(uint8_t))
@@ -59,6 +64,7 @@ const char* prefix_json(){
 }
 
 static pthread_mutex_t l_flush =  PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_cond_t c_flush = PTHREAD_COND_INITIALIZER; // writing_out cleared
 static pthread_mutex_t l_activity =  PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 static pthread_mutex_t l_agent =  PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 static pthread_mutex_t l_entity =  PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
@@ -96,6 +102,9 @@ void init_buffers(void){
 bool writing_out = false;
 
 static void (*print_json)(char* json);
+static struct provenance_sink* json_sink;
+static void (*print_compressed_json)(uint8_t* frame, size_t length);
+static struct compress_stream json_stream; // only used by the flushing thread
 
 int disclose_node_ProvJSON(uint64_t type, const char* content, union prov_identifier* identifier){
   int err;
@@ -120,11 +129,44 @@ int disclose_relation_ProvJSON(uint64_t type, union prov_identifier* sender, uni
   return provenance_disclose_relation(&relation);
 }
 
+static pthread_once_t buffers_once = PTHREAD_ONCE_INIT;
+
 void set_ProvJSON_callback( void (*fcn)(char* json) ){
-  init_buffers();
+  pthread_once(&buffers_once, init_buffers);
   print_json = fcn;
 }
 
+void set_ProvJSON_sink( struct provenance_sink* sink ){
+  pthread_once(&buffers_once, init_buffers);
+  pthread_mutex_lock(&l_flush);
+  json_sink = sink;
+  pthread_mutex_unlock(&l_flush);
+}
+
+int set_ProvJSON_compressed_callback( void (*fcn)(uint8_t* frame, size_t length), int level ){
+  int rc;
+
+  if(level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+    return -EINVAL;
+  pthread_once(&buffers_once, init_buffers);
+  pthread_mutex_lock(&l_flush);
+  while(writing_out) // the flushing thread may be using json_stream
+    pthread_cond_wait(&c_flush, &l_flush);
+  if(print_compressed_json != NULL)
+    compress_stream_end(&json_stream);
+  print_compressed_json = NULL;
+  if(fcn != NULL){
+    rc = compress_stream_init(&json_stream, level);
+    if(rc < 0){
+      pthread_mutex_unlock(&l_flush);
+      return rc;
+    }
+    print_compressed_json = fcn;
+  }
+  pthread_mutex_unlock(&l_flush);
+  return 0;
+}
+
 static inline bool __append(char destination[MAX_PROVJSON_BUFFER_LENGTH], char* source){
   if (strlen(source) + 2 > MAX_PROVJSON_BUFFER_LENGTH - strlen(destination) - 1){ // not enough space
     return false;
@@ -223,26 +265,260 @@ static inline char* ready_to_print(){
   return json;
 }
 
+/*
+* Compact mode: node references of a batch (prov:entity, prov:activity...)
+* are replaced by "@n", n being the index of the identifier in the "cf:dict"
+* array added at the end of the document. ProvJSON_expand reverses this.
+*/
+static bool compact_json = false;
+
+int set_ProvJSON_compact(bool v){
+  pthread_mutex_lock(&l_flush);
+  compact_json = v;
+  pthread_mutex_unlock(&l_flush);
+  return 0;
+}
+
+static const char* reference_keys[] = {"prov:entity", "prov:activity",
+  "prov:informant", "prov:informed", "prov:usedEntity", "prov:generatedEntity",
+  "cf:hasParent", NULL};
+
+#define REF_ID_LEN            (PROV_ID_STR_LEN-1)
+#define DICT_KEY              ",\"cf:dict\":["
+#define DICT_HASH_EXP         12
+#define DICT_HASH_SIZE        (1 << DICT_HASH_EXP)
+
+/* @pos position of the opening quote of the value, return true if it belongs to a reference key */
+static inline bool __is_reference(const char* start, const char* pos){
+  const char* key_end = pos - 2; // closing quote of the key
+  const char* key;
+  const char* b;
+  size_t len;
+  int i;
+
+  if(key_end <= start || key_end[0]!='"' || key_end[1]!=':')
+    return false;
+  for(key = key_end - 1; key > start && *key != '"'; key--);
+  if(*key != '"')
+    return false;
+  for(b = key - 1; b >= start && *b == '\\'; b--); // escaped quote, not a key
+  if((key - b - 1) % 2 != 0)
+    return false;
+  key++;
+  len = key_end - key;
+  for(i=0; reference_keys[i]!=NULL; i++){
+    if(strlen(reference_keys[i])==len && memcmp(reference_keys[i], key, len)==0)
+      return true;
+  }
+  return false;
+}
+
+static inline uint32_t __ref_hash(const char* ref){
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for(i=0; i<REF_ID_LEN; i++)
+    h = (h ^ (uint8_t)ref[i]) * 16777619u;
+  return h & (DICT_HASH_SIZE-1);
+}
+
+static char* compact(const char* json){
+  static const char* slots[DICT_HASH_SIZE]; // only used by the flushing thread
+  static uint32_t slot_index[DICT_HASH_SIZE];
+  const char** dict;
+  size_t dict_len = 0;
+  size_t len = strlen(json);
+  const char* p = json;
+  const char* m;
+  const char* ref;
+  char* out;
+  char* o;
+  char tmp[16];
+  uint32_t h;
+  size_t i;
+
+  // worst case, every reference is unique and costs a few bytes more
+  out = malloc(len + ((len / REF_ID_LEN) + 1) * 8 + sizeof(DICT_KEY) + 2);
+  dict = malloc(((len / REF_ID_LEN) + 1) * sizeof(char*));
+  if(out==NULL || dict==NULL){
+    free(out);
+    free(dict);
+    return NULL;
+  }
+  memset(slots, 0, sizeof(slots));
+  o = out;
+  while((m = strstr(p, "\"cf:")) != NULL){
+    ref = m + 4;
+    if(!__is_reference(json, m)
+      || len - (ref - json) <= REF_ID_LEN
+      || ref[REF_ID_LEN] != '"'){
+      memcpy(o, p, ref - p);
+      o += ref - p;
+      p = ref;
+      continue;
+    }
+    for(h = __ref_hash(ref); slots[h] != NULL; h = (h + 1) & (DICT_HASH_SIZE-1)){
+      if(memcmp(slots[h], ref, REF_ID_LEN)==0)
+        break;
+    }
+    if(slots[h] == NULL){
+      if(dict_len >= DICT_HASH_SIZE/2){ // dictionary full, known references are still compacted
+        memcpy(o, p, ref - p);
+        o += ref - p;
+        p = ref;
+        continue;
+      }
+      slots[h] = ref;
+      slot_index[h] = dict_len;
+      dict[dict_len++] = ref;
+    }
+    memcpy(o, p, m - p);
+    o += m - p;
+    *o++ = '"';
+    *o++ = '@';
+    utoa(slot_index[h], tmp, DECIMAL);
+    memcpy(o, tmp, strlen(tmp));
+    o += strlen(tmp);
+    p = ref + REF_ID_LEN; // closing quote copied with the next chunk
+  }
+  memcpy(o, p, strlen(p) + 1);
+  o += strlen(p);
+  if(dict_len == 0 || o == out || o[-1] != '}'){
+    free(dict);
+    return out;
+  }
+  o--; // reopen the top-level object
+  memcpy(o, DICT_KEY, sizeof(DICT_KEY) - 1);
+  o += sizeof(DICT_KEY) - 1;
+  for(i=0; i<dict_len; i++){
+    if(i>0)
+      *o++ = ',';
+    *o++ = '"';
+    memcpy(o, dict[i], REF_ID_LEN);
+    o += REF_ID_LEN;
+    *o++ = '"';
+  }
+  *o++ = ']';
+  *o++ = '}';
+  *o = '\0';
+  free(dict);
+  return out;
+}
+
+char* ProvJSON_expand(const char* json){
+  const char* d = strstr(json, DICT_KEY);
+  const char** dict;
+  size_t dict_len = 0;
+  size_t body_len;
+  const char* p;
+  const char* m;
+  char* out;
+  char* o;
+  char* end;
+  unsigned long n;
+
+  if(d == NULL) // not compact
+    return strdup(json);
+  while(strstr(d + 1, DICT_KEY) != NULL)
+    d = strstr(d + 1, DICT_KEY);
+  body_len = d - json;
+  dict = malloc(((strlen(d) / (REF_ID_LEN + 3)) + 1) * sizeof(char*));
+  if(dict==NULL)
+    return NULL;
+  for(p = d + sizeof(DICT_KEY) - 1; *p == '"'; p += REF_ID_LEN + 3){
+    if(strlen(p) < REF_ID_LEN + 2 || p[REF_ID_LEN + 1] != '"')
+      goto error;
+    dict[dict_len++] = p + 1;
+    if(p[REF_ID_LEN + 2] != ',')
+      break;
+  }
+  // every "@n" (3 bytes at least) grows to "cf:<id>"
+  out = malloc(body_len + (body_len / 3 + 1) * (REF_ID_LEN + 1) + 2);
+  if(out==NULL)
+    goto error;
+  o = out;
+  p = json;
+  while((m = strstr(p, "\"@")) != NULL && m < d){
+    n = strtoul(m + 2, &end, DECIMAL);
+    if(end == m + 2 || *end != '"' || n >= dict_len || !__is_reference(json, m)){
+      memcpy(o, p, m + 2 - p);
+      o += m + 2 - p;
+      p = m + 2;
+      continue;
+    }
+    memcpy(o, p, m - p);
+    o += m - p;
+    memcpy(o, "\"cf:", 4);
+    o += 4;
+    memcpy(o, dict[n], REF_ID_LEN);
+    o += REF_ID_LEN;
+    p = end;
+  }
+  memcpy(o, p, d - p);
+  o += d - p;
+  *o++ = '}';
+  *o = '\0';
+  free(dict);
+  return out;
+
+error:
+  free(dict);
+  return NULL;
+}
+
+static inline void print_compressed(void (*fcn)(uint8_t* frame, size_t length), char* json){
+  uint8_t* frame;
+  size_t len;
+
+  if(compress_stream_frame(&json_stream, json, strlen(json), &frame, &len) < 0){
+    if(print_json!=NULL) // fallback to uncompressed output
+      print_json(json);
+    return;
+  }
+  fcn(frame, len);
+}
+
 void flush_json(){
+  void (*compressed)(uint8_t* frame, size_t length) = NULL;
+  struct provenance_sink* sink = NULL;
   bool should_flush=false;
+  bool compact_mode=false;
   char* json;
+  char* compacted;
 
+  // outputs are read once per batch, json_stream is not released while writing_out is set
   pthread_mutex_lock(&l_flush);
   if(!writing_out){
     writing_out = true;
     should_flush = true;
+    compressed = print_compressed_json;
+    sink = json_sink;
+    compact_mode = compact_json;
     update_time(); // we update the time
   }
   pthread_mutex_unlock(&l_flush);
 
   if(should_flush){
     json = ready_to_print();
+    if(json!=NULL && compact_mode){
+      compacted = compact(json);
+      if(compacted!=NULL){
+        free(json);
+        json = compacted;
+      }
+    }
     if(json!=NULL){
-      print_json(json);
+      if(compressed!=NULL)
+        print_compressed(compressed, json);
+      else if(sink!=NULL)
+        provenance_sink_write(sink, json, strlen(json));
+      else if(print_json!=NULL)
+        print_json(json);
       free(json);
     }
     pthread_mutex_lock(&l_flush);
     writing_out = false;
+    pthread_cond_broadcast(&c_flush);
     pthread_mutex_unlock(&l_flush);
   }
 }
@@ -292,300 +568,1037 @@ void append_derived(char* json_element){
 }
 
 static __thread char buffer[MAX_PROVJSON_BUFFER_LENGTH];
+static __thread size_t buffer_pos;
+static __thread bool entry_first; // no attribute written in the current entry yet
 #define BUFFER_LENGTH (MAX_PROVJSON_BUFFER_LENGTH-strnlen(buffer, MAX_PROVJSON_BUFFER_LENGTH))
+/* always keep a byte for the terminating null byte */
+#define BUFFER_ROOM (MAX_PROVJSON_BUFFER_LENGTH-1-buffer_pos)
 
-static __thread char id[PROV_ID_STR_LEN];
-static __thread char sender[PROV_ID_STR_LEN];
-static __thread char receiver[PROV_ID_STR_LEN];
-static __thread char parent_id[PROV_ID_STR_LEN];
-static __thread char taint[PATH_MAX];
+static inline void __emit(const char* str, size_t length){
+  if(length > BUFFER_ROOM)
+    length = BUFFER_ROOM;
+  memcpy(buffer+buffer_pos, str, length);
+  buffer_pos+=length;
+}
 
-#define RELATION_PREP_IDs(e) ID_ENCODE(e->identifier.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN);\
-                        ID_ENCODE(e->snd.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, sender, PROV_ID_STR_LEN);\
-                        ID_ENCODE(e->rcv.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, receiver, PROV_ID_STR_LEN)
+#define __emit_const(str) __emit(str, sizeof(str)-1)
 
-#define DISC_PREP_IDs(n) ID_ENCODE(n->identifier.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN);\
-                        ID_ENCODE(n->parent.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, parent_id, PROV_ID_STR_LEN)
+static inline void __emit_char(char c){
+  if(BUFFER_ROOM > 0)
+    buffer[buffer_pos++]=c;
+}
 
-#define NODE_PREP_IDs(n) ID_ENCODE(n->identifier.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN)
+static inline void __emit_uint64(uint64_t value){
+  char tmp[20];
+  char* p = tmp+sizeof(tmp);
+  do{
+    *--p = '0' + value%10;
+    value/=10;
+  }while(value);
+  __emit(p, tmp+sizeof(tmp)-p);
+}
 
-#define PACKET_PREP_IDs(p) ID_ENCODE(p->identifier.buffer, PROV_IDENTIFIER_BUFFER_LENGTH, id, PROV_ID_STR_LEN)
+static inline void __emit_int64(int64_t value){
+  if(value<0){
+    __emit_char('-');
+    __emit_uint64(-(uint64_t)value);
+  }else
+    __emit_uint64(value);
+}
 
+static const char hex_digits[] = "0123456789abcdef";
 
-static inline void prov_prep_taint(union prov_elt *n){
-  taint[0]='\0';
-  if (!prov_bloom_empty(prov_taint(n)))
-    TAINT_ENCODE(prov_taint(n), PROV_N_BYTES, taint, TAINT_STR_LEN);
+static inline void __emit_hex(uint64_t value){
+  char tmp[16];
+  char* p = tmp+sizeof(tmp);
+  do{
+    *--p = hex_digits[value&0xF];
+    value>>=4;
+  }while(value);
+  __emit(p, tmp+sizeof(tmp)-p);
 }
 
-static inline void __init_json_entry(const char* id)
-{
-  buffer[0]='\0';
-  strncat(buffer, "\"cf:", BUFFER_LENGTH);
-  strncat(buffer, id, BUFFER_LENGTH);
-  strncat(buffer, "\":{", BUFFER_LENGTH);
+/* escape straight into the output buffer, keeping room for closing quote and brace */
+static inline void __add_escaped(const char* value, size_t length){
+  size_t room = MAX_PROVJSON_BUFFER_LENGTH - buffer_pos;
+
+  if(room <= 2)
+    return;
+  buffer_pos += json_escape(buffer + buffer_pos, room - 2, value, length);
 }
 
-static inline void __add_attribute(const char* name, bool comma){
-  if(comma){
-    strncat(buffer, ",\"", BUFFER_LENGTH);
-  }else{
-    strncat(buffer, "\"", BUFFER_LENGTH);
+/* base64 straight into the output buffer, nothing is written if it does not fit */
+static inline void __add_base64(const void* value, size_t length){
+  size_t len = encode64Bound(length);
+
+  if(len > BUFFER_ROOM+1)
+    return;
+  if(base64encode(value, length, buffer+buffer_pos, len)!=0)
+    return;
+  buffer_pos+=len-1;
+}
+
+static inline void __add_identifier(const union prov_identifier* identifier){
+  __add_base64(identifier->buffer, PROV_IDENTIFIER_BUFFER_LENGTH);
+}
+
+/*
+* Large payloads repeat (environment variables, common packets), when a blob
+* store is set they are stored once and records carry their digest.
+*/
+#define BLOB_REF_PREFIX "blob:"
+#define BLOB_REF_LEN    (sizeof(BLOB_REF_PREFIX)-1+BLOB_DIGEST_STR_LEN)
+
+static struct blob_store* blob_store;
+static size_t blob_threshold;
+static __thread char blob_ref[BLOB_REF_LEN];
+static __thread const void* blob_ref_of; // payload blob_ref refers to in the current entry
+
+void set_ProvJSON_blob_store(struct blob_store* store, size_t threshold){
+  blob_threshold = threshold;
+  blob_store = store;
+}
+
+/* return false if the payload is to be written inline */
+static inline bool __add_blob(const void* value, size_t length){
+  uint8_t digest[BLOB_DIGEST_LENGTH];
+
+  if(blob_store == NULL || length < blob_threshold)
+    return false;
+  if(blob_store_put(blob_store, value, length, digest) < 0)
+    return false;
+  memcpy(blob_ref, BLOB_REF_PREFIX, sizeof(BLOB_REF_PREFIX)-1);
+  hexify(digest, BLOB_DIGEST_LENGTH, blob_ref+sizeof(BLOB_REF_PREFIX)-1, BLOB_DIGEST_STR_LEN);
+  blob_ref_of = value;
+  __emit_char('"');
+  __emit(blob_ref, BLOB_REF_LEN-1);
+  __emit_char('"');
+  return true;
+}
+
+/*
+* Relations reference the same few nodes over and over, encoded node
+* identifiers are kept in a small direct-mapped per-thread cache.
+*/
+#define ID_CACHE_EXP          8
+#define ID_CACHE_SIZE         (1 << ID_CACHE_EXP)
+#define ID_CACHE_FLUSH_STATS  4096 // lookups between updates of the global counters
+
+struct id_cache_entry{
+  bool valid;
+  uint8_t raw[PROV_IDENTIFIER_BUFFER_LENGTH];
+  char encoded[PROV_ID_STR_LEN];
+};
+
+static __thread struct id_cache_entry id_cache[ID_CACHE_SIZE];
+static __thread uint32_t id_cache_hits;
+static __thread uint32_t id_cache_misses;
+static uint64_t id_cache_total_hits;
+static uint64_t id_cache_total_misses;
+
+static inline uint32_t __id_hash(const uint8_t* raw){
+  uint64_t h = 0;
+  uint64_t v;
+  size_t i;
+
+  for(i=0; i+sizeof(uint64_t)<=PROV_IDENTIFIER_BUFFER_LENGTH; i+=sizeof(uint64_t)){
+    memcpy(&v, raw+i, sizeof(uint64_t));
+    h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
   }
-  strncat(buffer, name, BUFFER_LENGTH);
-  strncat(buffer, "\":", BUFFER_LENGTH);
+  for(; i<PROV_IDENTIFIER_BUFFER_LENGTH; i++)
+    h = (h ^ raw[i]) * 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(h >> (64 - ID_CACHE_EXP));
 }
 
-static inline void __add_uint32_attribute(const char* name, const uint32_t value, bool comma){
-  char tmp[32];
-  __add_attribute(name, comma);
-  strncat(buffer, utoa(value, tmp, DECIMAL), BUFFER_LENGTH);
+static inline void __id_cache_stats(void){
+  if(id_cache_hits + id_cache_misses < ID_CACHE_FLUSH_STATS)
+    return;
+  __atomic_fetch_add(&id_cache_total_hits, id_cache_hits, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&id_cache_total_misses, id_cache_misses, __ATOMIC_RELAXED);
+  id_cache_hits = 0;
+  id_cache_misses = 0;
 }
 
+static inline void __add_cached_identifier(const union prov_identifier* identifier){
+  struct id_cache_entry* entry = &id_cache[__id_hash(identifier->buffer)];
 
-static inline void __add_int32_attribute(const char* name, const int32_t value, bool comma){
-  char tmp[32];
-  __add_attribute(name, comma);
-  strncat(buffer, itoa(value, tmp, DECIMAL), BUFFER_LENGTH);
+  if(entry->valid && memcmp(entry->raw, identifier->buffer, PROV_IDENTIFIER_BUFFER_LENGTH)==0){
+    id_cache_hits++;
+  }else{
+    id_cache_misses++;
+    ID_ENCODE(identifier->buffer, PROV_IDENTIFIER_BUFFER_LENGTH, entry->encoded, PROV_ID_STR_LEN);
+    memcpy(entry->raw, identifier->buffer, PROV_IDENTIFIER_BUFFER_LENGTH);
+    entry->valid = true;
+  }
+  __emit(entry->encoded, PROV_ID_STR_LEN-1);
+  __id_cache_stats();
 }
 
-static inline void __add_uint32hex_attribute(const char* name, const uint32_t value, bool comma){
-  char tmp[32];
-  __add_attribute(name, comma);
-  strncat(buffer, "\"0x", BUFFER_LENGTH);
-  strncat(buffer, utoa(value, tmp, HEX), BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+void ProvJSON_id_cache_stats(uint64_t* hits, uint64_t* misses){
+  *hits = __atomic_load_n(&id_cache_total_hits, __ATOMIC_RELAXED);
+  *misses = __atomic_load_n(&id_cache_total_misses, __ATOMIC_RELAXED);
 }
 
-static inline void __add_uint64_attribute(const char* name, const uint64_t value, bool comma){
-  char tmp[64];
-  __add_attribute(name, comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  strncat(buffer, ulltoa(value, tmp, DECIMAL), BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+static inline void __init_json_entry(const union prov_identifier* identifier)
+{
+  buffer_pos=0;
+  entry_first=true;
+  blob_ref_of=NULL;
+  __emit_const("\"cf:");
+  // a relation identifier is seen once, do not let it evict node identifiers
+  if((identifier->relation_id.type & DM_RELATION) != 0)
+    __add_identifier(identifier);
+  else
+    __add_cached_identifier(identifier);
+  __emit_const("\":{");
 }
 
-static inline void __add_uint64hex_attribute(const char* name, const uint64_t value, bool comma){
-  char tmp[64];
-  __add_attribute(name, comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  strncat(buffer, ulltoa(value, tmp, HEX), BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+static inline void __close_json_entry(void)
+{
+  __emit_char('}');
+  buffer[buffer_pos]='\0';
 }
 
-static inline void __add_int64_attribute(const char* name, const int64_t value, bool comma){
-  char tmp[64];
-  __add_attribute(name, comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  strncat(buffer, lltoa(value, tmp, DECIMAL), BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+static inline void __add_date(void){
+  __emit_char('"');
+  pthread_rwlock_rdlock(&date_lock);
+  __emit(date, strnlen(date, sizeof(date)));
+  pthread_rwlock_unlock(&date_lock);
+  __emit_char('"');
 }
 
-static inline void __add_string_attribute(const char* name, const char* value, bool comma){
-  if(value[0]=='\0'){ // value is not set
-    return;
+static inline void __open_label(const char* type){
+  if(!entry_first)
+    __emit_const(",\"prov:label\":\"");
+  else
+    __emit_const("\"prov:label\":\"");
+  entry_first=false;
+  if(type!=NULL){
+    __emit_char('[');
+    __emit(type, strlen(type));
+    __emit_const("] ");
   }
-  __add_attribute(name, comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  strncat(buffer, value, BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
 }
 
-static inline void __add_machine_id(uint32_t value, bool comma){
-  char tmp[32];
-  __add_attribute("cf:machine_id", comma);
-  strncat(buffer, "\"cf:", BUFFER_LENGTH);
-  strncat(buffer, utoa(value, tmp, DECIMAL), BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+static inline void __add_label_attribute(const char* type, const char* text){
+  __open_label(type);
+  if(text!=NULL)
+    __add_escaped(text, strlen(text));
+  __emit_char('"');
 }
 
-static inline void __add_reference(const char* name, const char* id, bool comma){
-  if(id[0]=='\0'){ // value is not set
-    return;
+static inline void __add_ipv4(uint32_t ip, uint32_t port){
+  char tmp[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &ip, tmp, INET_ADDRSTRLEN);
+  __emit(tmp, strlen(tmp));
+  __emit_char(':');
+  __emit_uint64(htons(port));
+}
+
+#define UUID_STR_SIZE 37
+char* uuid_to_str(uint8_t* uuid, char* str, size_t size){
+  if(size<37){
+    snprintf(str, size, "UUID-ERROR");
+    return str;
   }
-  __add_attribute(name, comma);
-  strncat(buffer, "\"cf:", BUFFER_LENGTH);
-  strncat(buffer, id, BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+  snprintf(str, size, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+    uuid[0], uuid[1], uuid[2], uuid[3]
+    , uuid[4], uuid[5]
+    , uuid[6], uuid[7]
+    , uuid[8], uuid[9]
+    , uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+    return str;
 }
 
+static inline void __add_uuid(const uint8_t* uuid){
+  char tmp[UUID_STR_SIZE-1];
+  int i, j;
 
-static inline void __add_json_attribute(const char* name, const char* value, bool comma){
-  __add_attribute(name, comma);
-  strncat(buffer, value, BUFFER_LENGTH);
+  for(i=0, j=0; i<16; i++){
+    if(i==4 || i==6 || i==8 || i==10)
+      tmp[j++]='-';
+    tmp[j++]=hex_digits[uuid[i]>>4];
+    tmp[j++]=hex_digits[uuid[i]&0xF];
+  }
+  __emit_char('"');
+  __emit(tmp, j);
+  __emit_char('"');
+}
+
+/* numeric only, getnameinfo may block on DNS */
+static inline const char* __sockaddr_host(const struct sockaddr* addr, char* host, size_t len){
+  if(addr->sa_family == AF_INET)
+    return inet_ntop(AF_INET, &((struct sockaddr_in*)addr)->sin_addr, host, len);
+  return inet_ntop(AF_INET6, &((struct sockaddr_in6*)addr)->sin6_addr, host, len);
+}
+
+static inline uint16_t __sockaddr_port(const struct sockaddr* addr){
+  if(addr->sa_family == AF_INET)
+    return ntohs(((struct sockaddr_in*)addr)->sin_port);
+  return ntohs(((struct sockaddr_in6*)addr)->sin6_port);
+}
+
+/* raw path, callers escape it where it is written */
+static inline const char* __sockaddr_path(const struct sockaddr* addr, size_t length, char* path, size_t len){
+  const struct sockaddr_un* un = (const struct sockaddr_un*)addr;
+  const char* p = un->sun_path;
+  char* o = path;
+  size_t plen;
+
+  path[0] = '\0';
+  if(length <= offsetof(struct sockaddr_un, sun_path))
+    return path;
+  plen = length - offsetof(struct sockaddr_un, sun_path);
+  if(plen > sizeof(un->sun_path))
+    plen = sizeof(un->sun_path);
+  if(p[0] == '\0' && plen > 1){ // abstract socket
+    *o++ = '@';
+    len--;
+    p++;
+    plen--;
+  }
+  plen = strnlen(p, plen);
+  if(plen > len - 1)
+    plen = len - 1;
+  memcpy(o, p, plen);
+  o[plen] = '\0';
+  return path;
 }
 
-static inline void __add_date_attribute(bool comma){
-  __add_attribute("cf:date", comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  pthread_rwlock_rdlock(&date_lock);
-  strncat(buffer, date, BUFFER_LENGTH);
-  pthread_rwlock_unlock(&date_lock);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+char* sockaddr_to_json(char* buf, size_t blen, struct sockaddr* addr, size_t length){
+  char host[INET6_ADDRSTRLEN];
+  char name[NI_MAXHOST];
+  char escaped[jsonEscapeBound(NI_MAXHOST)];
+  char path[PATH_MAX];
+  const char* type;
+
+  if(addr->sa_family == AF_INET || addr->sa_family == AF_INET6){
+    type = (addr->sa_family == AF_INET) ? "AF_INET" : "AF_INET6";
+    __sockaddr_host(addr, host, INET6_ADDRSTRLEN);
+    if(provenance_resolver_lookup(addr, length, name, NI_MAXHOST) == 0){
+      // names come from /etc/hosts, NSS or a user callback
+      json_escape(escaped, sizeof(escaped), name, NI_MAXHOST);
+      snprintf(buf, blen, "{\"type\":\"%s\", \"host\":\"%s\", \"serv\":\"%u\", \"hostname\":\"%s\"}", type, host, __sockaddr_port(addr), escaped);
+    }else
+      snprintf(buf, blen, "{\"type\":\"%s\", \"host\":\"%s\", \"serv\":\"%u\"}", type, host, __sockaddr_port(addr));
+  }else if(addr->sa_family == AF_UNIX){
+    __sockaddr_path(addr, length, path, PATH_MAX);
+    json_escape(escaped, sizeof(escaped), path, PATH_MAX);
+    snprintf(buf, blen, "{\"type\":\"AF_UNIX\", \"path\":\"%s\"}", escaped);
+  }else{
+    snprintf(buf, blen, "{\"type\":\"OTHER\"}");
+  }
+
+  return buf;
 }
 
-static inline void __add_label_attribute(const char* type, const char* text, bool comma){
-  __add_attribute("prov:label", comma);
-  if(type!=NULL){
-    strncat(buffer, "\"[", BUFFER_LENGTH);
-    strncat(buffer, type, BUFFER_LENGTH);
-    strncat(buffer, "] ", BUFFER_LENGTH);
+char* sockaddr_to_label(char* buf, size_t blen, struct sockaddr* addr, size_t length){
+  char host[INET6_ADDRSTRLEN];
+  char path[PATH_MAX];
+
+  if(addr->sa_family == AF_INET){
+    snprintf(buf, blen, "IPV4 %s", __sockaddr_host(addr, host, INET6_ADDRSTRLEN));
+  }else if(addr->sa_family == AF_INET6){
+    snprintf(buf, blen, "IPV6 %s", __sockaddr_host(addr, host, INET6_ADDRSTRLEN));
+  }else if(addr->sa_family == AF_UNIX){
+    snprintf(buf, blen, "UNIX %s", __sockaddr_path(addr, length, path, PATH_MAX));
   }else{
-    strncat(buffer, "\"", BUFFER_LENGTH);
+    snprintf(buf, blen, "OTHER");
   }
-  if(text!=NULL)
-    strncat(buffer, text, BUFFER_LENGTH);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+
+  return buf;
 }
 
+/*
+* Record schemas. Each kernel structure is described once by a table of
+* fields; the key fragment (",\"name\":") is computed by the preprocessor so
+* that constant bytes are copied with a single memcpy. Adding a kernel field
+* to the output means adding a line to the corresponding table.
+*/
+#define FIELD(name, st, member, kind) FIELD_OPT(name, st, member, kind, 0, 0, 0)
+#define FIELD_OPT(name, st, member, kind, opt, aux, match) \
+  {name, ",\"" name "\":", sizeof(",\"" name "\":")-1, kind, opt, match,\
+    offsetof(st, member), sizeof(((st*)0)->member), aux}
+
+#define NODE_HEADER_FIELDS(st) \
+  FIELD_OPT("cf:id", st, identifier.node_id.id, FIELD_UINT_STR, FIELD_ALWAYS, 0, 0),\
+  FIELD_OPT("prov:type", st, identifier.node_id.type, FIELD_NODE_TYPE, FIELD_ALWAYS, 0, 0),\
+  FIELD_OPT("cf:boot_id", st, identifier.node_id.boot_id, FIELD_UINT, FIELD_ALWAYS, 0, 0),\
+  FIELD_OPT("cf:machine_id", st, identifier.node_id.machine_id, FIELD_MACHINE, FIELD_ALWAYS, 0, 0),\
+  FIELD_OPT("cf:version", st, identifier.node_id.version, FIELD_UINT, FIELD_ALWAYS, 0, 0),\
+  FIELD_OPT("cf:date", st, jiffies, FIELD_DATE, FIELD_ALWAYS, 0, 0),\
+  FIELD("cf:taint", st, taint, FIELD_TAINT),\
+  FIELD_OPT("cf:jiffies", st, jiffies, FIELD_UINT_STR, FIELD_ALWAYS, 0, 0)
+
+#define RELATION_FIELDS(snd_name, rcv_name) \
+  FIELD("cf:id", struct relation_struct, identifier.relation_id.id, FIELD_UINT_STR),\
+  FIELD("prov:type", struct relation_struct, identifier.relation_id.type, FIELD_RELATION_TYPE),\
+  FIELD("cf:boot_id", struct relation_struct, identifier.relation_id.boot_id, FIELD_UINT),\
+  FIELD("cf:machine_id", struct relation_struct, identifier.relation_id.machine_id, FIELD_MACHINE),\
+  FIELD("cf:date", struct relation_struct, jiffies, FIELD_DATE),\
+  FIELD("cf:taint", struct relation_struct, taint, FIELD_TAINT),\
+  FIELD("cf:jiffies", struct relation_struct, jiffies, FIELD_UINT_STR),\
+  FIELD("prov:label", struct relation_struct, identifier.relation_id.type, FIELD_RELATION_TYPE),\
+  FIELD_OPT("cf:allowed", struct relation_struct, allowed, FIELD_BOOL, 0, 0, FLOW_ALLOWED),\
+  FIELD(snd_name, struct relation_struct, snd, FIELD_REFERENCE),\
+  FIELD(rcv_name, struct relation_struct, rcv, FIELD_REFERENCE),\
+  FIELD_OPT("cf:offset", struct relation_struct, offset, FIELD_INT_STR,\
+    FIELD_IF_EQUAL|FIELD_POSITIVE, offsetof(struct relation_struct, set), FILE_INFO_SET),\
+  FIELD("cf:flags", struct relation_struct, flags, FIELD_HEX_STR)
+
+static const struct prov_field used_fields[] = {
+  RELATION_FIELDS("prov:entity", "prov:activity")
+};
+
+static const struct prov_field generated_fields[] = {
+  RELATION_FIELDS("prov:activity", "prov:entity")
+};
+
+static const struct prov_field informed_fields[] = {
+  RELATION_FIELDS("prov:informant", "prov:informed")
+};
+
+static const struct prov_field derived_fields[] = {
+  RELATION_FIELDS("prov:usedEntity", "prov:generatedEntity")
+};
+
+static const struct prov_field task_fields[] = {
+  NODE_HEADER_FIELDS(struct task_prov_struct),
+  FIELD("cf:uid", struct task_prov_struct, uid, FIELD_UINT),
+  FIELD("cf:gid", struct task_prov_struct, gid, FIELD_UINT),
+  FIELD("cf:pid", struct task_prov_struct, pid, FIELD_UINT),
+  FIELD("cf:vpid", struct task_prov_struct, vpid, FIELD_UINT),
+  FIELD("cf:ppid", struct task_prov_struct, ppid, FIELD_UINT),
+  FIELD("cf:tgid", struct task_prov_struct, tgid, FIELD_UINT),
+  FIELD("cf:utsns", struct task_prov_struct, utsns, FIELD_UINT),
+  FIELD("cf:ipcns", struct task_prov_struct, ipcns, FIELD_UINT),
+  FIELD("cf:mntns", struct task_prov_struct, mntns, FIELD_UINT),
+  FIELD("cf:pidns", struct task_prov_struct, pidns, FIELD_UINT),
+  FIELD("cf:netns", struct task_prov_struct, netns, FIELD_UINT),
+  FIELD("cf:cgroupns", struct task_prov_struct, cgroupns, FIELD_UINT),
+  FIELD("cf:secctx", struct task_prov_struct, secid, FIELD_SECCTX),
+  FIELD("cf:utime", struct task_prov_struct, utime, FIELD_UINT_STR),
+  FIELD("cf:stime", struct task_prov_struct, stime, FIELD_UINT_STR),
+  FIELD("cf:vm", struct task_prov_struct, vm, FIELD_UINT_STR),
+  FIELD("cf:rss", struct task_prov_struct, rss, FIELD_UINT_STR),
+  FIELD("cf:hw_vm", struct task_prov_struct, hw_vm, FIELD_UINT_STR),
+  FIELD("cf:hw_rss", struct task_prov_struct, hw_rss, FIELD_UINT_STR),
+  FIELD("cf:rbytes", struct task_prov_struct, rbytes, FIELD_UINT_STR),
+  FIELD("cf:wbytes", struct task_prov_struct, wbytes, FIELD_UINT_STR),
+  FIELD("cf:cancel_wbytes", struct task_prov_struct, cancel_wbytes, FIELD_UINT_STR)
+};
+
+static const struct prov_field inode_fields[] = {
+  NODE_HEADER_FIELDS(struct inode_prov_struct),
+  FIELD("cf:uid", struct inode_prov_struct, uid, FIELD_UINT),
+  FIELD("cf:gid", struct inode_prov_struct, gid, FIELD_UINT),
+  FIELD("cf:mode", struct inode_prov_struct, mode, FIELD_HEX),
+  FIELD("cf:secctx", struct inode_prov_struct, secid, FIELD_SECCTX),
+  FIELD("cf:ino", struct inode_prov_struct, ino, FIELD_UINT),
+  FIELD("cf:uuid", struct inode_prov_struct, sb_uuid, FIELD_UUID)
+};
+
+static const struct prov_field iattr_fields[] = {
+  NODE_HEADER_FIELDS(struct iattr_prov_struct),
+  FIELD("cf:valid", struct iattr_prov_struct, valid, FIELD_HEX),
+  FIELD("cf:mode", struct iattr_prov_struct, mode, FIELD_HEX),
+  FIELD("cf:uid", struct iattr_prov_struct, uid, FIELD_UINT),
+  FIELD("cf:gid", struct iattr_prov_struct, gid, FIELD_UINT),
+  FIELD("cf:size", struct iattr_prov_struct, size, FIELD_INT_STR),
+  FIELD("cf:atime", struct iattr_prov_struct, atime, FIELD_INT_STR),
+  FIELD("cf:ctime", struct iattr_prov_struct, ctime, FIELD_INT_STR),
+  FIELD("cf:mtime", struct iattr_prov_struct, mtime, FIELD_INT_STR)
+};
+
+static const struct prov_field xattr_fields[] = {
+  NODE_HEADER_FIELDS(struct xattr_prov_struct),
+  FIELD("cf:name", struct xattr_prov_struct, name, FIELD_STRING),
+  FIELD_OPT("cf:size", struct xattr_prov_struct, size, FIELD_UINT, FIELD_NONZERO, 0, 0)
+};
+
+static const struct prov_field pckcnt_fields[] = {
+  NODE_HEADER_FIELDS(struct pckcnt_struct),
+  FIELD_OPT("cf:content", struct pckcnt_struct, content, FIELD_BASE64, FIELD_BLOB, offsetof(struct pckcnt_struct, length), 0),
+  FIELD("cf:length", struct pckcnt_struct, length, FIELD_UINT),
+  FIELD_OPT("cf:truncated", struct pckcnt_struct, truncated, FIELD_BOOL, 0, 0, PROV_TRUNCATED)
+};
+
+static const struct prov_field sb_fields[] = {
+  NODE_HEADER_FIELDS(struct sb_struct),
+  FIELD("cf:uuid", struct sb_struct, uuid, FIELD_UUID)
+};
+
+static const struct prov_field msg_fields[] = {
+  NODE_HEADER_FIELDS(struct msg_msg_struct)
+};
+
+static const struct prov_field shm_fields[] = {
+  NODE_HEADER_FIELDS(struct shm_struct),
+  FIELD("cf:mode", struct shm_struct, mode, FIELD_HEX)
+};
+
+static const struct prov_field packet_fields[] = {
+  FIELD("cf:id", struct pck_struct, identifier.packet_id.id, FIELD_UINT),
+  FIELD("cf:seq", struct pck_struct, identifier.packet_id.seq, FIELD_UINT),
+  FIELD_OPT("cf:sender", struct pck_struct, identifier.packet_id.snd_ip, FIELD_IPV4, 0, offsetof(struct pck_struct, identifier.packet_id.snd_port), 0),
+  FIELD_OPT("cf:receiver", struct pck_struct, identifier.packet_id.rcv_ip, FIELD_IPV4, 0, offsetof(struct pck_struct, identifier.packet_id.rcv_port), 0),
+  FIELD("prov:type", struct pck_struct, identifier.packet_id.type, FIELD_NODE_TYPE),
+  FIELD("cf:taint", struct pck_struct, taint, FIELD_TAINT),
+  FIELD("cf:jiffies", struct pck_struct, jiffies, FIELD_UINT_STR)
+};
+
+static const struct prov_field str_fields[] = {
+  NODE_HEADER_FIELDS(struct str_struct),
+  FIELD("cf:log", struct str_struct, str, FIELD_STRING)
+};
+
+static const struct prov_field addr_fields[] = {
+  NODE_HEADER_FIELDS(struct address_struct),
+  FIELD_OPT("cf:address", struct address_struct, addr, FIELD_SOCKADDR, 0, offsetof(struct address_struct, length), 0)
+};
+
+static const struct prov_field pathname_fields[] = {
+  NODE_HEADER_FIELDS(struct file_name_struct),
+  FIELD("cf:pathname", struct file_name_struct, name, FIELD_STRING)
+};
+
+static const struct prov_field arg_fields[] = {
+  NODE_HEADER_FIELDS(struct arg_struct),
+  FIELD_OPT("cf:value", struct arg_struct, value, FIELD_STRING, FIELD_BLOB, 0, 0),
+  FIELD_OPT("cf:truncated", struct arg_struct, truncated, FIELD_BOOL, 0, 0, PROV_TRUNCATED)
+};
+
+static const struct prov_field disc_fields[] = {
+  NODE_HEADER_FIELDS(struct disc_node_struct),
+  FIELD("cf:hasParent", struct disc_node_struct, parent, FIELD_REFERENCE)
+};
+
+/*
+* Projection: bit i of projection is set if field i of the table is emitted,
+* PROJECT_LABEL covers the prov:label attribute added by the serializers,
+* PROJECT_PATH cf:path added to inodes from the path cache. Excluded fields
+* are neither looked up nor formatted.
+*/
+#define PROJECT_ALL   UINT64_MAX
+#define PROJECT_LABEL (1ULL<<63)
+#define PROJECT_PATH  (1ULL<<62)
+
+struct prov_schema{
+  const struct prov_field* fields;
+  size_t count;
+  uint64_t projection;
+};
+
+/* fails to compile if a table has a field aliasing PROJECT_LABEL or PROJECT_PATH */
+#define SCHEMA_COUNT(fields) (sizeof(fields)/sizeof(struct prov_field)\
+  + 0*sizeof(char[(sizeof(fields)/sizeof(struct prov_field) < 62) ? 1 : -1]))
+#define SCHEMA_INIT(fields) {fields, SCHEMA_COUNT(fields), PROJECT_ALL}
+#define projected_label(schema) (((schema).projection & PROJECT_LABEL) != 0)
+#define projected_path(schema) (((schema).projection & PROJECT_PATH) != 0)
+
+static struct prov_schema used_schema = SCHEMA_INIT(used_fields);
+static struct prov_schema generated_schema = SCHEMA_INIT(generated_fields);
+static struct prov_schema informed_schema = SCHEMA_INIT(informed_fields);
+static struct prov_schema derived_schema = SCHEMA_INIT(derived_fields);
+static struct prov_schema task_schema = SCHEMA_INIT(task_fields);
+static struct prov_schema inode_schema = SCHEMA_INIT(inode_fields);
+static struct prov_schema iattr_schema = SCHEMA_INIT(iattr_fields);
+static struct prov_schema xattr_schema = SCHEMA_INIT(xattr_fields);
+static struct prov_schema pckcnt_schema = SCHEMA_INIT(pckcnt_fields);
+static struct prov_schema sb_schema = SCHEMA_INIT(sb_fields);
+static struct prov_schema msg_schema = SCHEMA_INIT(msg_fields);
+static struct prov_schema shm_schema = SCHEMA_INIT(shm_fields);
+static struct prov_schema packet_schema = SCHEMA_INIT(packet_fields);
+static struct prov_schema str_schema = SCHEMA_INIT(str_fields);
+static struct prov_schema addr_schema = SCHEMA_INIT(addr_fields);
+static struct prov_schema pathname_schema = SCHEMA_INIT(pathname_fields);
+static struct prov_schema arg_schema = SCHEMA_INIT(arg_fields);
+static struct prov_schema disc_schema = SCHEMA_INIT(disc_fields);
+
+static struct prov_schema* __schema(uint64_t type){
+  if((type & DM_RELATION) != 0){
+    if(prov_is_used(type))
+      return &used_schema;
+    else if(prov_is_informed(type))
+      return &informed_schema;
+    else if(prov_is_generated(type))
+      return &generated_schema;
+    else if(prov_is_derived(type))
+      return &derived_schema;
+    return NULL;
+  }
+  switch(type){
+    case ACT_TASK:
+      return &task_schema;
+    case ENT_INODE_UNKNOWN:
+    case ENT_INODE_LINK:
+    case ENT_INODE_FILE:
+    case ENT_INODE_DIRECTORY:
+    case ENT_INODE_CHAR:
+    case ENT_INODE_BLOCK:
+    case ENT_INODE_FIFO:
+    case ENT_INODE_SOCKET:
+    case ENT_INODE_MMAP:
+      return &inode_schema;
+    case ENT_IATTR:
+      return &iattr_schema;
+    case ENT_XATTR:
+      return &xattr_schema;
+    case ENT_PCKCNT:
+      return &pckcnt_schema;
+    case ENT_SBLCK:
+      return &sb_schema;
+    case ENT_MSG:
+      return &msg_schema;
+    case ENT_SHM:
+      return &shm_schema;
+    case ENT_PACKET:
+      return &packet_schema;
+    case ENT_STR:
+      return &str_schema;
+    case ENT_ADDR:
+      return &addr_schema;
+    case ENT_FILE_NAME:
+      return &pathname_schema;
+    case ENT_ARG:
+    case ENT_ENV:
+      return &arg_schema;
+    case ENT_DISC:
+    case ACT_DISC:
+    case AGT_DISC:
+      return &disc_schema;
+    default:
+      return NULL;
+  }
+}
 
+const struct prov_field* provenance_schema(uint64_t type, size_t* count){
+  struct prov_schema* schema = __schema(type);
 
-static inline void __add_ipv4(uint32_t ip, uint32_t port){
-    char tmp[8];
-    strncat(buffer, uint32_to_ipv4str(ip), BUFFER_LENGTH);
-    strncat(buffer, ":", BUFFER_LENGTH);
-    strncat(buffer, utoa(htons(port), tmp, DECIMAL), BUFFER_LENGTH);
+  if(schema==NULL){
+    *count = 0;
+    return NULL;
+  }
+  *count = schema->count;
+  return schema->fields;
 }
 
-static inline void __add_ipv4_attribute(const char* name, const uint32_t ip, const uint32_t port, bool comma){
-  char tmp[64];
-  __add_attribute(name, comma);
-  strncat(buffer, "\"", BUFFER_LENGTH);
-  __add_ipv4(ip, port);
-  strncat(buffer, "\"", BUFFER_LENGTH);
+int set_ProvJSON_projection(uint64_t type, const char* names[], size_t count){
+  struct prov_schema* schema = __schema(type);
+  uint64_t projection = 0;
+  size_t i, j;
+
+  if(schema==NULL)
+    return -EINVAL;
+  if(names==NULL){
+    schema->projection = PROJECT_ALL;
+    return 0;
+  }
+  for(i=0; i<count; i++){
+    for(j=0; j<schema->count; j++){
+      if(strcmp(names[i], schema->fields[j].name)==0){
+        projection |= 1ULL<<j;
+        break;
+      }
+    }
+    if(j<schema->count)
+      continue;
+    if(strcmp(names[i], "prov:label")==0)
+      projection |= PROJECT_LABEL;
+    else if(strcmp(names[i], "cf:path")==0 && schema==&inode_schema)
+      projection |= PROJECT_PATH;
+    else
+      return -ENOENT;
+  }
+  schema->projection = projection;
+  return 0;
+}
+
+static inline uint64_t __load_uint(const uint8_t* p, size_t size){
+  uint8_t v8;
+  uint16_t v16;
+  uint32_t v32;
+  uint64_t v64;
+
+  switch(size){
+    case 1:
+      memcpy(&v8, p, 1);
+      return v8;
+    case 2:
+      memcpy(&v16, p, 2);
+      return v16;
+    case 4:
+      memcpy(&v32, p, 4);
+      return v32;
+    default:
+      memcpy(&v64, p, 8);
+      return v64;
+  }
 }
 
-static inline void __close_json_entry(char* buffer)
-{
-  strncat(buffer, "}", BUFFER_LENGTH);
+static inline int64_t __load_int(const uint8_t* p, size_t size){
+  int8_t v8;
+  int16_t v16;
+  int32_t v32;
+  int64_t v64;
+
+  switch(size){
+    case 1:
+      memcpy(&v8, p, 1);
+      return v8;
+    case 2:
+      memcpy(&v16, p, 2);
+      return v16;
+    case 4:
+      memcpy(&v32, p, 4);
+      return v32;
+    default:
+      memcpy(&v64, p, 8);
+      return v64;
+  }
 }
 
-static inline void __node_identifier(const struct node_identifier* n){
-  __add_uint64_attribute("cf:id", n->id, false);
-  __add_string_attribute("prov:type", node_id_to_str(n->type), true);
-  __add_uint32_attribute("cf:boot_id", n->boot_id, true);
-  __add_machine_id(n->machine_id, true);
-  __add_uint32_attribute("cf:version", n->version, true);
-}
-
-static inline void __node_start(const char* id,
-                                const struct node_identifier* n,
-                                const char* taint,
-                                uint64_t jiffies){
-  __init_json_entry(id);
-  __node_identifier(n);
-  __add_date_attribute(true);
-  __add_string_attribute("cf:taint", taint, true);
-  __add_uint64_attribute("cf:jiffies", jiffies, true);
-}
-
-static inline void __relation_identifier(const struct relation_identifier* e){
-  __add_uint64_attribute("cf:id", e->id, false);
-  __add_string_attribute("prov:type", relation_id_to_str(e->type), true);
-  __add_uint32_attribute("cf:boot_id", e->boot_id, true);
-  __add_machine_id(e->machine_id, true);
-}
-
-static char* __relation_to_json(struct relation_struct* e, const char* snd, const char* rcv){
-  RELATION_PREP_IDs(e);
-  prov_prep_taint((union prov_elt*)e);
-  __init_json_entry(id);
-  __relation_identifier(&(e->identifier.relation_id));
-  __add_date_attribute(true);
-  __add_string_attribute("cf:taint", taint, true);
-  __add_uint64_attribute("cf:jiffies", e->jiffies, true);
-  __add_label_attribute(NULL, relation_id_to_str(e->identifier.relation_id.type), true);
-  if(e->allowed==FLOW_ALLOWED)
-    __add_string_attribute("cf:allowed", "true", true);
-  else
-    __add_string_attribute("cf:allowed", "false", true);
-  __add_reference(snd, sender, true);
-  __add_reference(rcv, receiver, true);
-  if(e->set==FILE_INFO_SET && e->offset>0)
-    __add_int64_attribute("cf:offset", e->offset, true); // just offset for now
-  __add_uint64hex_attribute("cf:flags", e->flags, true);
-  __close_json_entry(buffer);
+/* return false if the field should not appear in the output */
+static inline bool __field_present(const uint8_t* record, const struct prov_field* f){
+  const uint8_t* p = record + f->offset;
+
+  if((f->opt & FIELD_IF_EQUAL) && record[f->aux] != f->match)
+    return false;
+  if((f->opt & FIELD_NONZERO) && __load_uint(p, f->size) == 0)
+    return false;
+  if((f->opt & FIELD_POSITIVE) && __load_int(p, f->size) <= 0)
+    return false;
+  switch(f->kind){
+    case FIELD_STRING:
+      return p[0]!='\0';
+    case FIELD_TAINT:
+      return !prov_bloom_empty(p);
+    default:
+      return true;
+  }
+}
+
+static inline void __add_string(const char* str, size_t length){
+  __emit_char('"');
+  __add_escaped(str, length);
+  __emit_char('"');
+}
+
+static void __encode_fields(const void* elt, const struct prov_schema* schema, uint64_t projection){
+  const uint8_t* record = (const uint8_t*)elt;
+  const struct prov_field* f;
+  const uint8_t* p;
+  const char* str;
+  char tmp[PATH_MAX+1024];
+  size_t length;
+  size_t i;
+
+  for(i=0; i<schema->count; i++){
+    if((projection & (1ULL<<i)) == 0)
+      continue;
+    f = &schema->fields[i];
+    p = record + f->offset;
+    if(!__field_present(record, f))
+      continue;
+    // type strings and secctx are resolved before writing the key, they may be unknown
+    switch(f->kind){
+      case FIELD_NODE_TYPE:
+        str = node_id_to_str(__load_uint(p, f->size));
+        if(str==NULL || str[0]=='\0')
+          continue;
+        break;
+      case FIELD_RELATION_TYPE:
+        str = relation_id_to_str(__load_uint(p, f->size));
+        if(str==NULL || str[0]=='\0')
+          continue;
+        break;
+      case FIELD_SECCTX:
+        tmp[0]='\0';
+        if(provenance_secid_to_secctx(__load_uint(p, f->size), tmp, PATH_MAX)<0 || tmp[0]=='\0')
+          continue;
+        str = tmp;
+        break;
+      default:
+        str = NULL;
+    }
+    if(entry_first){
+      __emit(f->key+1, f->key_len-1);
+      entry_first=false;
+    }else
+      __emit(f->key, f->key_len);
+    switch(f->kind){
+      case FIELD_UINT:
+        __emit_uint64(__load_uint(p, f->size));
+        break;
+      case FIELD_INT:
+        __emit_int64(__load_int(p, f->size));
+        break;
+      case FIELD_UINT_STR:
+        __emit_char('"');
+        __emit_uint64(__load_uint(p, f->size));
+        __emit_char('"');
+        break;
+      case FIELD_INT_STR:
+        __emit_char('"');
+        __emit_int64(__load_int(p, f->size));
+        __emit_char('"');
+        break;
+      case FIELD_HEX:
+        __emit_const("\"0x");
+        __emit_hex(__load_uint(p, f->size));
+        __emit_char('"');
+        break;
+      case FIELD_HEX_STR:
+        __emit_char('"');
+        __emit_hex(__load_uint(p, f->size));
+        __emit_char('"');
+        break;
+      case FIELD_STRING:
+        length = strnlen((const char*)p, f->size);
+        if((f->opt & FIELD_BLOB) && __add_blob(p, length))
+          break;
+        __add_string((const char*)p, length);
+        break;
+      case FIELD_BOOL:
+        if(*p == f->match)
+          __emit_const("\"true\"");
+        else
+          __emit_const("\"false\"");
+        break;
+      case FIELD_MACHINE:
+        __emit_const("\"cf:");
+        __emit_uint64(__load_uint(p, f->size));
+        __emit_char('"');
+        break;
+      case FIELD_NODE_TYPE:
+      case FIELD_RELATION_TYPE:
+      case FIELD_SECCTX:
+        __add_string(str, strlen(str));
+        break;
+      case FIELD_UUID:
+        __add_uuid(p);
+        break;
+      case FIELD_DATE:
+        __add_date();
+        break;
+      case FIELD_TAINT:
+        TAINT_ENCODE((uint8_t*)p, PROV_N_BYTES, tmp, TAINT_STR_LEN);
+        __emit_char('"');
+        __emit(tmp, strlen(tmp));
+        __emit_char('"');
+        break;
+      case FIELD_REFERENCE:
+        __emit_const("\"cf:");
+        __add_cached_identifier((const union prov_identifier*)p);
+        __emit_char('"');
+        break;
+      case FIELD_BASE64:
+        length = __load_uint(record + f->aux, sizeof(size_t));
+        if(length > f->size)
+          length = f->size;
+        if((f->opt & FIELD_BLOB) && __add_blob(p, length))
+          break;
+        __emit_char('"');
+        __add_base64(p, length);
+        __emit_char('"');
+        break;
+      case FIELD_IPV4:
+        __emit_char('"');
+        __add_ipv4(__load_uint(p, f->size), __load_uint(record + f->aux, sizeof(uint16_t)));
+        __emit_char('"');
+        break;
+      case FIELD_SOCKADDR:
+        sockaddr_to_json(tmp, sizeof(tmp), (struct sockaddr*)p, __load_uint(record + f->aux, sizeof(size_t)));
+        __emit(tmp, strlen(tmp));
+        break;
+    }
+  }
+}
+
+#define ENCODE(elt, schema) __encode_fields(elt, &schema, schema.projection)
+
+/*
+* Delta mode: the last emitted state of a node is kept in a per-thread
+* direct-mapped cache keyed by node identity (without version). A new version
+* only carries the identity attributes, the attributes that changed and
+* "cf:delta_of" referencing the version it applies to. A full snapshot is
+* emitted on cache miss (eviction) and every delta_snapshot versions.
+*/
+struct delta_entry{
+  bool valid;
+  uint32_t deltas;
+  union prov_elt state;
+};
+
+static uint32_t delta_slots = 0; // 0 when delta mode is disabled
+static uint32_t delta_snapshot;
+static pthread_key_t delta_key;
+static pthread_once_t delta_once = PTHREAD_ONCE_INIT;
+static __thread struct delta_entry* delta_cache;
+static __thread uint32_t delta_cache_slots;
+
+static void init_delta_key(void){
+  pthread_key_create(&delta_key, free);
+}
+
+int set_ProvJSON_delta(uint32_t slots, uint32_t snapshot){
+  uint32_t n = 1;
+
+  if(slots == 0){
+    __atomic_store_n(&delta_slots, 0, __ATOMIC_RELAXED);
+    return 0;
+  }
+  if(snapshot == 0)
+    return -EINVAL;
+  while(n < slots && n < (1U << 31))
+    n <<= 1;
+  pthread_once(&delta_once, init_delta_key);
+  delta_snapshot = snapshot;
+  __atomic_store_n(&delta_slots, n, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static inline bool __same_node(const struct node_identifier* a, const struct node_identifier* b){
+  return a->type == b->type && a->id == b->id
+    && a->boot_id == b->boot_id && a->machine_id == b->machine_id;
+}
+
+static inline struct delta_entry* __delta_entry(const struct node_identifier* n){
+  uint32_t slots = __atomic_load_n(&delta_slots, __ATOMIC_RELAXED);
+  uint64_t h;
+
+  if(slots == 0)
+    return NULL;
+  if(delta_cache_slots != slots){ // first use by this thread or resized
+    free(delta_cache);
+    delta_cache = calloc(slots, sizeof(struct delta_entry));
+    delta_cache_slots = (delta_cache == NULL) ? 0 : slots;
+    pthread_setspecific(delta_key, delta_cache);
+    if(delta_cache == NULL)
+      return NULL;
+  }
+  h = (n->id ^ n->type ^ ((uint64_t)n->boot_id << 32) ^ n->machine_id) * 0x9E3779B97F4A7C15ULL;
+  return &delta_cache[(h >> 32) & (slots - 1)];
+}
+
+/*
+* fields that must appear in a delta, identity fields or modified since state.
+* Return 0 when a field present in state would be omitted from record (e.g.
+* a FIELD_NONZERO value back to 0): a delta cannot express it, the consumer
+* would keep the old value, the full record must be written.
+*/
+static inline uint64_t __delta_mask(const uint8_t* record, const uint8_t* state, const struct prov_schema* schema){
+  const struct prov_field* f;
+  uint64_t mask = PROJECT_LABEL;
+  bool present;
+  size_t i;
+
+  for(i=0; i<schema->count; i++){
+    if((schema->projection & (1ULL<<i)) == 0)
+      continue;
+    f = &schema->fields[i];
+    present = __field_present(record, f);
+    if(present != __field_present(state, f)){
+      if(!present)
+        return 0;
+      mask |= 1ULL<<i;
+    }else if((f->opt & FIELD_ALWAYS) != 0
+      || memcmp(record + f->offset, state + f->offset, f->size) != 0)
+      mask |= 1ULL<<i;
+  }
+  return mask;
+}
+
+/* return the projection used, a delta only carries what changed */
+static inline uint64_t __encode_node(const void* elt, const struct prov_schema* schema, size_t size){
+  const struct node_identifier* n = &((const union prov_elt*)elt)->node_info.identifier.node_id;
+  struct delta_entry* e = __delta_entry(n);
+  uint64_t projection = schema->projection;
+  uint64_t mask;
+
+  if(e == NULL || size > sizeof(e->state)){
+    __encode_fields(elt, schema, projection);
+    return projection;
+  }
+  if(e->valid
+    && e->deltas + 1 < delta_snapshot
+    && __same_node(n, &e->state.node_info.identifier.node_id)
+    && n->version != e->state.node_info.identifier.node_id.version
+    && (mask = __delta_mask(elt, (const uint8_t*)&e->state, schema)) != 0){
+    projection &= mask;
+    __encode_fields(elt, schema, projection);
+    if(!entry_first)
+      __emit_char(',');
+    entry_first=false;
+    __emit_const("\"cf:delta_of\":\"cf:");
+    __add_cached_identifier(&e->state.node_info.identifier);
+    __emit_char('"');
+    e->deltas++;
+  }else{
+    __encode_fields(elt, schema, schema->projection);
+    e->deltas = 0;
+  }
+  memcpy(&e->state, elt, size);
+  e->valid = true;
+  return projection;
+}
+
+#define ENCODE_NODE(elt, schema) __encode_node(elt, &schema, sizeof(*elt))
+
+static inline char* __relation_to_json(struct relation_struct* e, const struct prov_schema* schema){
+  __init_json_entry(&e->identifier);
+  __encode_fields(e, schema, schema->projection);
+  __close_json_entry();
   return buffer;
 }
 
+char* relation_to_json(struct relation_struct* e){
+  const struct prov_schema* schema = __schema(e->identifier.relation_id.type);
+
+  if(schema==NULL)
+    return NULL;
+  return __relation_to_json(e, schema);
+}
+
 char* used_to_json(struct relation_struct* e){
-  return __relation_to_json(e, "prov:entity", "prov:activity");
+  return __relation_to_json(e, &used_schema);
 }
 
 char* generated_to_json(struct relation_struct* e){
-  return __relation_to_json(e, "prov:activity", "prov:entity");
+  return __relation_to_json(e, &generated_schema);
 }
 
 char* informed_to_json(struct relation_struct* e){
-  return __relation_to_json(e, "prov:informant", "prov:informed");
+  return __relation_to_json(e, &informed_schema);
 }
 
 char* derived_to_json(struct relation_struct* e){
-  return __relation_to_json(e, "prov:usedEntity", "prov:generatedEntity");
+  return __relation_to_json(e, &derived_schema);
 }
 
 char* disc_to_json(struct disc_node_struct* n){
-  DISC_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_reference("cf:hasParent", parent_id, true);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, disc_schema);
   if(n->length > 0){
-    strncat(buffer, ",", BUFFER_LENGTH);
-    strncat(buffer, n->content, BUFFER_LENGTH);
+    if(!entry_first)
+      __emit_char(',');
+    entry_first=false;
+    __emit(n->content, strnlen(n->content, PATH_MAX));
   }
-  __close_json_entry(buffer);
+  __close_json_entry();
   return buffer;
 }
 
 char* task_to_json(struct task_prov_struct* n){
   char tmp[33];
-  char secctx[PATH_MAX];
-  provenance_secid_to_secctx(n->secid, secctx, PATH_MAX);
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_uint32_attribute("cf:uid", n->uid, true);
-  __add_uint32_attribute("cf:gid", n->gid, true);
-  __add_uint32_attribute("cf:pid", n->pid, true);
-  __add_uint32_attribute("cf:vpid", n->vpid, true);
-  __add_uint32_attribute("cf:ppid", n->ppid, true);
-  __add_uint32_attribute("cf:tgid", n->tgid, true);
-  __add_uint32_attribute("cf:utsns", n->utsns, true);
-  __add_uint32_attribute("cf:ipcns", n->ipcns, true);
-  __add_uint32_attribute("cf:mntns", n->mntns, true);
-  __add_uint32_attribute("cf:pidns", n->pidns, true);
-  __add_uint32_attribute("cf:netns", n->netns, true);
-  __add_uint32_attribute("cf:cgroupns", n->cgroupns, true);
-  __add_string_attribute("cf:secctx", secctx, true);
-  __add_uint64_attribute("cf:utime", n->utime, true);
-  __add_uint64_attribute("cf:stime", n->stime, true);
-  __add_uint64_attribute("cf:vm", n->vm, true);
-  __add_uint64_attribute("cf:rss", n->rss, true);
-  __add_uint64_attribute("cf:hw_vm", n->hw_vm, true);
-  __add_uint64_attribute("cf:hw_rss", n->hw_rss, true);
-  __add_uint64_attribute("cf:rbytes", n->rbytes, true);
-  __add_uint64_attribute("cf:wbytes", n->wbytes, true);
-  __add_uint64_attribute("cf:cancel_wbytes", n->cancel_wbytes, true);
-  __add_label_attribute("task", utoa(n->identifier.node_id.version, tmp, DECIMAL), true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE_NODE(n, task_schema);
+  if(projected_label(task_schema))
+    __add_label_attribute("task", utoa(n->identifier.node_id.version, tmp, DECIMAL));
+  __close_json_entry();
   return buffer;
 }
 
-#define UUID_STR_SIZE 37
-char* uuid_to_str(uint8_t* uuid, char* str, size_t size){
-  if(size<37){
-    snprintf(str, size, "UUID-ERROR");
-    return str;
-  }
-  snprintf(str, size, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-    uuid[0], uuid[1], uuid[2], uuid[3]
-    , uuid[4], uuid[5]
-    , uuid[6], uuid[7]
-    , uuid[8], uuid[9]
-    , uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
-    return str;
-}
-
 static const char STR_UNKNOWN[]= "unknown";
 static const char STR_BLOCK_SPECIAL[]= "block special";
 static const char STR_CHAR_SPECIAL[]= "char special";
@@ -615,235 +1628,134 @@ static inline const char* get_inode_type(mode_t mode){
 
 
 char* inode_to_json(struct inode_prov_struct* n){
-  char uuid[UUID_STR_SIZE];
   char tmp[65];
-  char secctx[PATH_MAX];
-  provenance_secid_to_secctx(n->secid, secctx, PATH_MAX);
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_uint32_attribute("cf:uid", n->uid, true);
-  __add_uint32_attribute("cf:gid", n->gid, true);
-  __add_uint32hex_attribute("cf:mode", n->mode, true);
-  __add_string_attribute("cf:secctx", secctx, true);
-  __add_uint32_attribute("cf:ino", n->ino, true);
-  __add_string_attribute("cf:uuid", uuid_to_str(n->sb_uuid, uuid, UUID_STR_SIZE), true);
-  __add_label_attribute(node_id_to_str(n->identifier.node_id.type), utoa(n->identifier.node_id.version, tmp, DECIMAL), true);
-  __close_json_entry(buffer);
+  char path[PATH_MAX];
+  uint64_t projection;
+  __init_json_entry(&n->identifier);
+  projection = ENCODE_NODE(n, inode_schema);
+  // deltas rely on the full record for the path
+  if((projection & PROJECT_PATH) && provenance_path_cache_lookup(&n->identifier, path, PATH_MAX)==0){
+    if(!entry_first)
+      __emit_char(',');
+    __emit_const("\"cf:path\":\"");
+    entry_first=false;
+    __add_escaped(path, strlen(path));
+    __emit_char('"');
+  }
+  if(projected_label(inode_schema))
+    __add_label_attribute(node_id_to_str(n->identifier.node_id.type), utoa(n->identifier.node_id.version, tmp, DECIMAL));
+  __close_json_entry();
   return buffer;
 }
 
 char* iattr_to_json(struct iattr_prov_struct* n){
   char tmp[65];
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_uint32hex_attribute("cf:valid", n->valid, true);
-  __add_uint32hex_attribute("cf:mode", n->mode, true);
-  __add_uint32_attribute("cf:uid", n->uid, true);
-  __add_uint32_attribute("cf:gid", n->gid, true);
-  __add_int64_attribute("cf:size", n->size, true);
-  __add_int64_attribute("cf:atime", n->atime, true);
-  __add_int64_attribute("cf:ctime", n->ctime, true);
-  __add_int64_attribute("cf:mtime", n->mtime, true);
-  __add_label_attribute("iattr", utoa(n->identifier.node_id.id, tmp, DECIMAL), true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, iattr_schema);
+  if(projected_label(iattr_schema))
+    __add_label_attribute("iattr", utoa(n->identifier.node_id.id, tmp, DECIMAL));
+  __close_json_entry();
   return buffer;
 }
 
 char* xattr_to_json(struct xattr_prov_struct* n){
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_string_attribute("cf:name", n->name, true);
-  if(n->size>0){
-    __add_uint32_attribute("cf:size", n->size, true);
-    // TODO record value when present
-  }
-  __add_label_attribute("xattr", n->name, true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, xattr_schema);
+  // TODO record value when present
+  if(projected_label(xattr_schema))
+    __add_label_attribute("xattr", n->name);
+  __close_json_entry();
   return buffer;
 }
 
 char* pckcnt_to_json(struct pckcnt_struct* n){
-  char* cntenc;
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  cntenc = malloc( encode64Bound(n->length) );
-  base64encode(n->content, n->length, cntenc, encode64Bound(n->length));
-  __add_string_attribute("cf:content", cntenc, true);
-  free(cntenc);
-  __add_uint32_attribute("cf:length", n->length, true);
-  if(n->truncated==PROV_TRUNCATED)
-    __add_string_attribute("cf:truncated", "true", true);
-  else
-    __add_string_attribute("cf:truncated", "false", true);
-  __add_label_attribute("content", NULL, true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, pckcnt_schema);
+  if(projected_label(pckcnt_schema))
+    __add_label_attribute("content", NULL);
+  __close_json_entry();
   return buffer;
 }
 
 char* sb_to_json(struct sb_struct* n){
-  char uuid[UUID_STR_SIZE];
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_string_attribute("cf:uuid", uuid_to_str(n->uuid, uuid, UUID_STR_SIZE), true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, sb_schema);
+  __close_json_entry();
   return buffer;
 }
 
 char* msg_to_json(struct msg_msg_struct* n){
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, msg_schema);
+  __close_json_entry();
   return buffer;
 }
 
 char* shm_to_json(struct shm_struct* n){
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_uint32hex_attribute("cf:mode", n->mode, true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, shm_schema);
+  __close_json_entry();
   return buffer;
 }
 
 char* packet_to_json(struct pck_struct* p){
-  char tmp[256];
-  PACKET_PREP_IDs(p);
-  prov_prep_taint((union prov_elt*)p);
-  __init_json_entry(id);
-  __add_uint32_attribute("cf:id", p->identifier.packet_id.id, false);
-  __add_uint32_attribute("cf:seq", p->identifier.packet_id.seq, true);
-  __add_ipv4_attribute("cf:sender", p->identifier.packet_id.snd_ip, p->identifier.packet_id.snd_port, true);
-  __add_ipv4_attribute("cf:receiver", p->identifier.packet_id.rcv_ip, p->identifier.packet_id.rcv_port, true);
-  __add_string_attribute("prov:type", "packet", true);
-  __add_string_attribute("cf:taint", taint, true);
-  __add_uint64_attribute("cf:jiffies", p->jiffies, true);
-  strncat(buffer, ",\"prov:label\":\"[packet] ", BUFFER_LENGTH);
-  __add_ipv4(p->identifier.packet_id.snd_ip, p->identifier.packet_id.snd_port);
-  strncat(buffer, "->", BUFFER_LENGTH);
-  __add_ipv4(p->identifier.packet_id.rcv_ip, p->identifier.packet_id.rcv_port);
-  strncat(buffer, " (", BUFFER_LENGTH);
-  strncat(buffer, utoa(p->identifier.packet_id.id, tmp, DECIMAL), BUFFER_LENGTH);
-  strncat(buffer, ")\"", BUFFER_LENGTH);
-  __close_json_entry(buffer);
+  __init_json_entry(&p->identifier);
+  ENCODE(p, packet_schema);
+  if(projected_label(packet_schema)){
+    __open_label("packet");
+    __add_ipv4(p->identifier.packet_id.snd_ip, p->identifier.packet_id.snd_port);
+    __emit_const("->");
+    __add_ipv4(p->identifier.packet_id.rcv_ip, p->identifier.packet_id.rcv_port);
+    __emit_const(" (");
+    __emit_uint64(p->identifier.packet_id.id);
+    __emit_const(")\"");
+  }
+  __close_json_entry();
   return buffer;
 }
 
 char* str_msg_to_json(struct str_struct* n){
-  int i=0;
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  for(i=0; i < n->length; i++){
-    if(n->str[i]=='"')
-      n->str[i]=' ';
-    if(n->str[i]<32 || n->str[i]>125)
-      n->str[i]='_';
-  }
-  __add_string_attribute("cf:log", n->str, true);
-  __add_label_attribute("log", n->str, true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, str_schema);
+  if(projected_label(str_schema))
+    __add_label_attribute("log", n->str);
+  __close_json_entry();
   return buffer;
 }
 
-char* sockaddr_to_json(char* buf, size_t blen, struct sockaddr* addr, size_t length){
-  char host[NI_MAXHOST];
-  char serv[NI_MAXSERV];
-
-  if(addr->sa_family == AF_INET){
-    getnameinfo(addr, length, host, NI_MAXHOST, serv, NI_MAXSERV, 0);
-    snprintf(buf, blen, "{\"type\":\"AF_INET\", \"host\":\"%s\", \"serv\":\"%s\"}", host, serv);
-  }else if(addr->sa_family == AF_INET6){
-    getnameinfo(addr, length, host, NI_MAXHOST, serv, NI_MAXSERV, 0);
-    snprintf(buf, blen, "{\"type\":\"AF_INET6\", \"host\":\"%s\", \"serv\":\"%s\"}", host, serv);
-  }else if(addr->sa_family == AF_UNIX){
-    snprintf(buf, blen, "{\"type\":\"AF_UNIX\", \"path\":\"%s\"}", ((struct sockaddr_un*)addr)->sun_path);
-  }else{
-    snprintf(buf, blen, "{\"type\":\"OTHER\"}");
-  }
-
-  return buf;
-}
-
-char* sockaddr_to_label(char* buf, size_t blen, struct sockaddr* addr, size_t length){
-  char host[NI_MAXHOST];
-  char serv[NI_MAXSERV];
-
-  if(addr->sa_family == AF_INET){
-    getnameinfo(addr, length, host, NI_MAXHOST, serv, NI_MAXSERV, 0);
-    snprintf(buf, blen, "IPV4 %s", host);
-  }else if(addr->sa_family == AF_INET6){
-    getnameinfo(addr, length, host, NI_MAXHOST, serv, NI_MAXSERV, 0);
-    snprintf(buf, blen, "IPV6 %s", host);
-  }else if(addr->sa_family == AF_UNIX){
-    snprintf(buf, blen, "UNIX %s", ((struct sockaddr_un*)addr)->sun_path);
-  }else{
-    snprintf(buf, blen, "OTHER");
-  }
-
-  return buf;
-}
-
 char* addr_to_json(struct address_struct* n){
   char addr_info[PATH_MAX+1024];
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  __add_json_attribute("cf:address", sockaddr_to_json(addr_info, PATH_MAX+1024, &n->addr, n->length), true);
-  __add_label_attribute("address", sockaddr_to_label(addr_info, PATH_MAX+1024, &n->addr, n->length), true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, addr_schema);
+  if(projected_label(addr_schema))
+    __add_label_attribute("address", sockaddr_to_label(addr_info, PATH_MAX+1024, &n->addr, n->length));
+  __close_json_entry();
   return buffer;
 }
 
 char* pathname_to_json(struct file_name_struct* n){
-  int i;
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  for(i=0; i<n->length; i++){
-    if(n->name[i]=='\\')
-      n->name[i]='/';
-  }
-  __add_string_attribute("cf:pathname", n->name, true);
-  __add_label_attribute("path", n->name, true);
-  __close_json_entry(buffer);
+  __init_json_entry(&n->identifier);
+  ENCODE(n, pathname_schema);
+  if(projected_label(pathname_schema))
+    __add_label_attribute("path", n->name);
+  __close_json_entry();
   return buffer;
 }
 
 char* arg_to_json(struct arg_struct* n){
-  int i;
-  char* tmp;
-  NODE_PREP_IDs(n);
-  prov_prep_taint((union prov_elt*)n);
-  __node_start(id, &(n->identifier.node_id), taint, n->jiffies);
-  for(i=0; i<n->length; i++){
-    if(n->value[i]=='\\')
-      n->value[i]='/';
-    if(n->value[i]=='\n')
-      n->value[i]=' ';
-    if(n->value[i]=='\t')
-      n->value[i]=' ';
-  }
-  tmp = repl_str(n->value, "\"", "\\\"");
-  if(tmp==NULL)
-    tmp = n->value;
-  __add_string_attribute("cf:value", tmp, true);
-  if(n->truncated==PROV_TRUNCATED)
-    __add_string_attribute("cf:truncated", "true", true);
-  else
-    __add_string_attribute("cf:truncated", "false", true);
-  if(n->identifier.node_id.type == ENT_ARG)
-    __add_label_attribute("argv", tmp, true);
-  else
-    __add_label_attribute("envp", tmp, true);
-  __close_json_entry(buffer);
-  if(tmp != n->value)
-    free(tmp);
+  const char* value;
+
+  __init_json_entry(&n->identifier);
+  ENCODE(n, arg_schema);
+  // the label would repeat the value moved to the blob store
+  value = (blob_ref_of == n->value) ? blob_ref : n->value;
+  if(projected_label(arg_schema)){
+    if(n->identifier.node_id.type == ENT_ARG)
+      __add_label_attribute("argv", value);
+    else
+      __add_label_attribute("envp", value);
+  }
+  __close_json_entry();
   return buffer;
 }
 
@@ -0,0 +1,380 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "provenanceblob.h"
+
+#define BLOB_MAGIC          "CFBLOB01"
+#define BLOB_MAGIC_LENGTH   8
+#define BLOB_KEY_LENGTH     16
+#define BLOB_HEADER_LENGTH  (BLOB_MAGIC_LENGTH+BLOB_KEY_LENGTH)
+#define BLOB_RECORD_HEADER  (BLOB_DIGEST_LENGTH+sizeof(uint32_t))
+#define BLOB_INDEX_INITIAL  1024
+
+struct blob_entry{
+  bool used;
+  uint8_t digest[BLOB_DIGEST_LENGTH];
+  uint32_t length;
+  uint64_t offset;  // of the payload in the file
+};
+
+struct blob_store{
+  int fd;
+  uint64_t k0;
+  uint64_t k1;
+  uint64_t end;
+  struct blob_entry* index;
+  size_t index_size;  // power of 2
+  struct blob_stats stats;
+  pthread_mutex_t lock;
+};
+
+/* SipHash-2-4 with 128 bits output */
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do{ \
+  v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+  v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+  v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+  v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+}while(0)
+
+static void __siphash128(uint64_t k0, uint64_t k1, const uint8_t* in, size_t length, uint8_t* out){
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL ^ 0xee;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+  const uint8_t* end = in + (length & ~(size_t)7);
+  uint64_t b = ((uint64_t)length) << 56;
+  uint64_t m;
+  int left = length & 7;
+
+  for(; in != end; in += 8){
+    memcpy(&m, in, 8);
+    m = le64toh(m);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  while(left-- > 0)
+    b |= ((uint64_t)in[left]) << (8*left);
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xee;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  m = htole64(v0 ^ v1 ^ v2 ^ v3);
+  memcpy(out, &m, 8);
+  v1 ^= 0xdd;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  m = htole64(v0 ^ v1 ^ v2 ^ v3);
+  memcpy(out+8, &m, 8);
+}
+
+static inline int __pread_all(int fd, void* buf, size_t length, uint64_t offset){
+  uint8_t* p = (uint8_t*)buf;
+  ssize_t rc;
+
+  while(length > 0){
+    rc = pread(fd, p, length, offset);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    if(rc == 0)
+      return -EIO;
+    p += rc;
+    offset += rc;
+    length -= rc;
+  }
+  return 0;
+}
+
+static inline int __pwrite_all(int fd, const void* buf, size_t length, uint64_t offset){
+  const uint8_t* p = (const uint8_t*)buf;
+  ssize_t rc;
+
+  while(length > 0){
+    rc = pwrite(fd, p, length, offset);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    p += rc;
+    offset += rc;
+    length -= rc;
+  }
+  return 0;
+}
+
+/* header and payload in one call, a short write leaves a record __store_load drops */
+static inline int __pwrite_record(int fd, uint8_t* header, const void* data, size_t length, uint64_t offset){
+  struct iovec iov[2];
+  ssize_t rc;
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = BLOB_RECORD_HEADER;
+  iov[1].iov_base = (void*)data;
+  iov[1].iov_len = length;
+  do{
+    rc = pwritev(fd, iov, 2, offset);
+  }while(rc < 0 && errno == EINTR);
+  if(rc < 0)
+    return -errno;
+  if((size_t)rc < BLOB_RECORD_HEADER){ // short write, finish piecewise
+    rc = __pwrite_all(fd, header+rc, BLOB_RECORD_HEADER-rc, offset+rc);
+    if(rc < 0)
+      return rc;
+    rc = BLOB_RECORD_HEADER;
+  }
+  rc -= BLOB_RECORD_HEADER;
+  return __pwrite_all(fd, (const uint8_t*)data+rc, length-rc, offset+BLOB_RECORD_HEADER+rc);
+}
+
+/* digests are uniformly distributed, the first bytes are a good enough hash */
+static inline struct blob_entry* __index_find(struct blob_entry* index, size_t size, const uint8_t* digest){
+  uint64_t h;
+  size_t i;
+
+  memcpy(&h, digest, sizeof(h));
+  for(i = h & (size-1); index[i].used; i = (i+1) & (size-1)){
+    if(memcmp(index[i].digest, digest, BLOB_DIGEST_LENGTH) == 0)
+      break;
+  }
+  return &index[i];
+}
+
+static int __index_grow(struct blob_store* store){
+  struct blob_entry* index;
+  struct blob_entry* e;
+  size_t size = store->index_size*2;
+  size_t i;
+
+  index = (struct blob_entry*)calloc(size, sizeof(struct blob_entry));
+  if(index == NULL)
+    return -ENOMEM;
+  for(i=0; i<store->index_size; i++){
+    if(!store->index[i].used)
+      continue;
+    e = __index_find(index, size, store->index[i].digest);
+    memcpy(e, &store->index[i], sizeof(struct blob_entry));
+  }
+  free(store->index);
+  store->index = index;
+  store->index_size = size;
+  return 0;
+}
+
+/* load factor kept under 1/2 */
+static int __index_insert(struct blob_store* store, const uint8_t* digest, uint32_t length, uint64_t offset){
+  struct blob_entry* e;
+  int rc;
+
+  if((store->stats.blobs+1)*2 > store->index_size){
+    rc = __index_grow(store);
+    if(rc < 0)
+      return rc;
+  }
+  e = __index_find(store->index, store->index_size, digest);
+  if(e->used)
+    return 0;
+  e->used = true;
+  memcpy(e->digest, digest, BLOB_DIGEST_LENGTH);
+  e->length = length;
+  e->offset = offset;
+  store->stats.blobs++;
+  store->stats.bytes += length;
+  return 0;
+}
+
+static int __store_create(struct blob_store* store){
+  uint8_t header[BLOB_HEADER_LENGTH];
+  int fd;
+  int rc;
+
+  fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return -errno;
+  rc = read(fd, header+BLOB_MAGIC_LENGTH, BLOB_KEY_LENGTH);
+  close(fd);
+  if(rc != BLOB_KEY_LENGTH)
+    return -EIO;
+  memcpy(header, BLOB_MAGIC, BLOB_MAGIC_LENGTH);
+  rc = __pwrite_all(store->fd, header, BLOB_HEADER_LENGTH, 0);
+  if(rc < 0)
+    return rc;
+  memcpy(&store->k0, header+BLOB_MAGIC_LENGTH, 8);
+  memcpy(&store->k1, header+BLOB_MAGIC_LENGTH+8, 8);
+  store->end = BLOB_HEADER_LENGTH;
+  return 0;
+}
+
+/* rebuild the index, drop a partially written last record */
+static int __store_load(struct blob_store* store, uint64_t size){
+  uint8_t header[BLOB_HEADER_LENGTH];
+  uint8_t record[BLOB_RECORD_HEADER];
+  uint64_t offset = BLOB_HEADER_LENGTH;
+  uint32_t length;
+  int rc;
+
+  rc = __pread_all(store->fd, header, BLOB_HEADER_LENGTH, 0);
+  if(rc < 0)
+    return rc;
+  if(memcmp(header, BLOB_MAGIC, BLOB_MAGIC_LENGTH) != 0)
+    return -EINVAL;
+  memcpy(&store->k0, header+BLOB_MAGIC_LENGTH, 8);
+  memcpy(&store->k1, header+BLOB_MAGIC_LENGTH+8, 8);
+  while(offset + BLOB_RECORD_HEADER <= size){
+    rc = __pread_all(store->fd, record, BLOB_RECORD_HEADER, offset);
+    if(rc < 0)
+      return rc;
+    memcpy(&length, record+BLOB_DIGEST_LENGTH, sizeof(uint32_t));
+    length = le32toh(length);
+    if(offset + BLOB_RECORD_HEADER + length > size)
+      break;
+    rc = __index_insert(store, record, length, offset + BLOB_RECORD_HEADER);
+    if(rc < 0)
+      return rc;
+    offset += BLOB_RECORD_HEADER + length;
+  }
+  if(offset < size && ftruncate(store->fd, offset) < 0)
+    return -errno;
+  store->end = offset;
+  return 0;
+}
+
+struct blob_store* blob_store_open(const char* path){
+  struct blob_store* store;
+  struct stat st;
+  int rc;
+
+  store = (struct blob_store*)calloc(1, sizeof(struct blob_store));
+  if(store == NULL)
+    return NULL;
+  store->index_size = BLOB_INDEX_INITIAL;
+  store->index = (struct blob_entry*)calloc(store->index_size, sizeof(struct blob_entry));
+  if(store->index == NULL){
+    rc = -ENOMEM;
+    goto error;
+  }
+  store->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+  if(store->fd < 0){
+    rc = -errno;
+    goto error;
+  }
+  if(fstat(store->fd, &st) < 0)
+    rc = -errno;
+  else if(st.st_size < BLOB_HEADER_LENGTH)
+    rc = __store_create(store);
+  else
+    rc = __store_load(store, st.st_size);
+  if(rc < 0){
+    close(store->fd);
+    goto error;
+  }
+  pthread_mutex_init(&store->lock, NULL);
+  return store;
+
+error:
+  free(store->index);
+  free(store);
+  errno = -rc;
+  return NULL;
+}
+
+void blob_store_close(struct blob_store* store){
+  fdatasync(store->fd);
+  close(store->fd);
+  pthread_mutex_destroy(&store->lock);
+  free(store->index);
+  free(store);
+}
+
+int blob_store_put(struct blob_store* store, const void* data, size_t length, uint8_t* digest){
+  uint8_t record[BLOB_RECORD_HEADER];
+  struct blob_entry* e;
+  uint32_t len;
+  int rc;
+
+  if(length > BLOB_MAX_LENGTH)
+    return -E2BIG;
+  __siphash128(store->k0, store->k1, (const uint8_t*)data, length, digest);
+  pthread_mutex_lock(&store->lock);
+  e = __index_find(store->index, store->index_size, digest);
+  if(e->used){
+    store->stats.hits++;
+    pthread_mutex_unlock(&store->lock);
+    return 0;
+  }
+  memcpy(record, digest, BLOB_DIGEST_LENGTH);
+  len = htole32((uint32_t)length);
+  memcpy(record+BLOB_DIGEST_LENGTH, &len, sizeof(uint32_t));
+  rc = __pwrite_record(store->fd, record, data, length, store->end);
+  if(rc == 0)
+    rc = __index_insert(store, digest, length, store->end + BLOB_RECORD_HEADER);
+  if(rc == 0){
+    store->end += BLOB_RECORD_HEADER + length;
+    store->stats.misses++;
+    rc = 1;
+  }
+  pthread_mutex_unlock(&store->lock);
+  return rc;
+}
+
+ssize_t blob_store_get(struct blob_store* store, const uint8_t* digest, void* data, size_t length){
+  struct blob_entry* e;
+  uint64_t offset;
+  uint32_t len;
+  int rc;
+
+  pthread_mutex_lock(&store->lock);
+  e = __index_find(store->index, store->index_size, digest);
+  if(!e->used){
+    pthread_mutex_unlock(&store->lock);
+    return -ENOENT;
+  }
+  offset = e->offset;
+  len = e->length;
+  pthread_mutex_unlock(&store->lock);
+  // records are never modified once written
+  rc = __pread_all(store->fd, data, (len < length) ? len : length, offset);
+  if(rc < 0)
+    return rc;
+  return len;
+}
+
+void blob_store_stats(struct blob_store* store, struct blob_stats* stats){
+  pthread_mutex_lock(&store->lock);
+  memcpy(stats, &store->stats, sizeof(struct blob_stats));
+  pthread_mutex_unlock(&store->lock);
+}
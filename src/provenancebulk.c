@@ -0,0 +1,752 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "thpool.h"
+#include "provenance.h"
+#include "provenancebulk.h"
+
+/*
+* Each directory is a job: it is opened relative to the root descriptor,
+* its entries are opened relative to it and updated through fgetxattr/
+* fsetxattr (the fprovenance_* functions), subdirectories are queued as new
+* jobs. Jobs only carry a relative path, the number of open descriptors is
+* bounded by the number of threads. The path is resolved without following
+* any symbolic link (openat2, or one component at a time on older kernels),
+* a directory swapped for a link while queued is not escaped through.
+*/
+#define TREE_PROGRESS_INTERVAL 10000
+
+struct tree_walk{
+  const struct tree_config* config;
+  int root_fd;
+  dev_t dev;
+  threadpool pool;
+  struct tree_progress progress;  // updated atomically
+  uint64_t next_report;
+  pthread_mutex_t lock;           // serialises callbacks
+};
+
+struct tree_job{
+  struct tree_walk* walk;
+  char* path;                     // relative to the root, "" for the root
+};
+
+static inline void __count(uint64_t* counter){
+  __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void __snapshot(struct tree_walk* walk, struct tree_progress* p){
+  p->directories = __atomic_load_n(&walk->progress.directories, __ATOMIC_RELAXED);
+  p->entries = __atomic_load_n(&walk->progress.entries, __ATOMIC_RELAXED);
+  p->updated = __atomic_load_n(&walk->progress.updated, __ATOMIC_RELAXED);
+  p->skipped = __atomic_load_n(&walk->progress.skipped, __ATOMIC_RELAXED);
+  p->errors = __atomic_load_n(&walk->progress.errors, __ATOMIC_RELAXED);
+}
+
+static void __report_error(struct tree_walk* walk, const char* path, int err){
+  __count(&walk->progress.errors);
+  if(walk->config->error == NULL)
+    return;
+  pthread_mutex_lock(&walk->lock);
+  walk->config->error((path[0] == '\0') ? "." : path, err, walk->config->data);
+  pthread_mutex_unlock(&walk->lock);
+}
+
+static void __report_progress(struct tree_walk* walk){
+  struct tree_progress p;
+  uint64_t entries = __atomic_add_fetch(&walk->progress.entries, 1, __ATOMIC_RELAXED);
+
+  if(walk->config->progress == NULL || entries < __atomic_load_n(&walk->next_report, __ATOMIC_RELAXED))
+    return;
+  if(pthread_mutex_trylock(&walk->lock) != 0)
+    return; // someone else is reporting
+  if(entries >= __atomic_load_n(&walk->next_report, __ATOMIC_RELAXED)){
+    __atomic_store_n(&walk->next_report, entries + (walk->config->progress_interval ? walk->config->progress_interval : TREE_PROGRESS_INTERVAL), __ATOMIC_RELAXED);
+    __snapshot(walk, &p);
+    walk->config->progress(&p, walk->config->data);
+  }
+  pthread_mutex_unlock(&walk->lock);
+}
+
+static inline bool __match(const char** patterns, size_t count, const char* path, const char* name){
+  size_t i;
+
+  for(i = 0; i < count; i++){
+    if(strchr(patterns[i], '/') != NULL){
+      if(fnmatch(patterns[i], path, FNM_PATHNAME) == 0)
+        return true;
+    }else if(fnmatch(patterns[i], name, 0) == 0)
+      return true;
+  }
+  return false;
+}
+
+static int __apply_fd(int fd, const char* path, const struct tree_config* config){
+  union prov_elt prov;
+
+  switch(config->op){
+    case TREE_TRACK:
+      return fprovenance_track_file(fd, config->value);
+    case TREE_OPAQUE:
+      return fprovenance_opaque_file(fd, config->value);
+    case TREE_PROPAGATE:
+      return fprovenance_propagate_file(fd, config->value);
+    case TREE_LABEL:
+      return fprovenance_label_file(fd, config->label);
+    case TREE_READ:
+      if(fprovenance_read_file(fd, &prov) < 0)
+        return -1;
+      config->inode(&prov, path, config->data);
+      return 0;
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+/* devices, fifos and sockets are not opened, they are reached by path (see __visit_entry) */
+static int __apply_path(const char* proc, const char* path, const struct tree_config* config){
+  union prov_elt prov;
+
+  switch(config->op){
+    case TREE_TRACK:
+      return provenance_track_file(proc, config->value);
+    case TREE_OPAQUE:
+      return provenance_opaque_file(proc, config->value);
+    case TREE_PROPAGATE:
+      return provenance_propagate_file(proc, config->value);
+    case TREE_LABEL:
+      return provenance_label_file(proc, config->label);
+    case TREE_READ:
+      if(provenance_read_file(proc, &prov) < 0)
+        return -1;
+      config->inode(&prov, path, config->data);
+      return 0;
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+static inline bool __selected(struct tree_walk* walk, const char* path, const char* name){
+  const struct tree_config* c = walk->config;
+
+  return c->include_count == 0 || __match(c->include, c->include_count, path, name);
+}
+
+static char* __join(const char* dir, const char* name){
+  char* path;
+
+  if(dir[0] == '\0')
+    return strdup(name);
+  if(asprintf(&path, "%s/%s", dir, name) < 0)
+    return NULL;
+  return path;
+}
+
+/* open path below root_fd, no symbolic link is followed on the way */
+static int __open_beneath(int root_fd, const char* path){
+  struct open_how how;
+  char* copy;
+  char* name;
+  char* next;
+  int fd;
+  int tmp;
+
+  if(path[0] == '\0')
+    return openat(root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  memset(&how, 0, sizeof(struct open_how));
+  how.flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+  fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(struct open_how));
+  if(fd >= 0 || errno != ENOSYS)
+    return fd;
+  copy = strdup(path);
+  if(copy == NULL){
+    errno = ENOMEM;
+    return -1;
+  }
+  fd = root_fd;
+  for(name = copy; name != NULL; name = next){
+    next = strchr(name, '/');
+    if(next != NULL)
+      *next++ = '\0';
+    tmp = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(fd != root_fd)
+      close(fd);
+    fd = tmp;
+    if(fd < 0)
+      break;
+  }
+  free(copy);
+  return fd;
+}
+
+static void tree_job(void* data);
+
+static void __queue_directory(struct tree_walk* walk, char* path){
+  struct tree_job* job = malloc(sizeof(struct tree_job));
+
+  if(job == NULL){
+    __report_error(walk, path, ENOMEM);
+    free(path);
+    return;
+  }
+  job->walk = walk;
+  job->path = path;
+  if(thpool_add_work(walk->pool, tree_job, job) != 0)
+    tree_job(job); // queue allocation failed, do it here
+}
+
+static void __visit_entry(struct tree_walk* walk, int dirfd, const char* dir, struct dirent* d){
+  const struct tree_config* c = walk->config;
+  char proc[PATH_MAX];
+  struct stat st;
+  unsigned char type = d->d_type;
+  char* path;
+  int fd;
+
+  path = __join(dir, d->d_name);
+  if(path == NULL){
+    __report_error(walk, d->d_name, ENOMEM);
+    return;
+  }
+  __report_progress(walk);
+  if(c->exclude_count > 0 && __match(c->exclude, c->exclude_count, path, d->d_name)){
+    __count(&walk->progress.skipped);
+    goto out;
+  }
+  if(type == DT_UNKNOWN){ // some filesystems do not fill d_type
+    if(fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0){
+      __report_error(walk, path, errno);
+      goto out;
+    }
+    type = IFTODT(st.st_mode);
+  }
+  switch(type){
+    case DT_DIR: // applied by the job handling it
+      __queue_directory(walk, path);
+      return;
+    case DT_LNK:
+      __count(&walk->progress.skipped);
+      break;
+    case DT_REG:
+      if(!__selected(walk, path, d->d_name)){
+        __count(&walk->progress.skipped);
+        break;
+      }
+      fd = openat(dirfd, d->d_name, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if(fd < 0 || __apply_fd(fd, path, c) < 0)
+        __report_error(walk, path, errno);
+      else
+        __count(&walk->progress.updated);
+      if(fd >= 0)
+        close(fd);
+      break;
+    default:
+      if(!__selected(walk, path, d->d_name)){
+        __count(&walk->progress.skipped);
+        break;
+      }
+      // pin the inode without opening it, it may have been swapped for a link since readdir
+      fd = openat(dirfd, d->d_name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+      if(fd < 0){
+        __report_error(walk, path, errno);
+        break;
+      }
+      if(fstat(fd, &st) < 0)
+        __report_error(walk, path, errno);
+      else if(S_ISLNK(st.st_mode) || S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))
+        __count(&walk->progress.skipped); // changed under us, not ours to follow
+      else{
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+        if(__apply_path(proc, path, c) < 0)
+          __report_error(walk, path, errno);
+        else
+          __count(&walk->progress.updated);
+      }
+      close(fd);
+  }
+out:
+  free(path);
+}
+
+static void tree_job(void* data){
+  struct tree_job* job = (struct tree_job*)data;
+  struct tree_walk* walk = job->walk;
+  const char* name;
+  struct dirent* d;
+  struct stat st;
+  DIR* dir;
+  int fd;
+
+  fd = __open_beneath(walk->root_fd, job->path);
+  if(fd < 0){
+    __report_error(walk, job->path, errno);
+    goto out;
+  }
+  if(!walk->config->cross_mounts && job->path[0] != '\0'){
+    if(fstat(fd, &st) < 0 || st.st_dev != walk->dev){
+      __count(&walk->progress.skipped);
+      close(fd);
+      goto out;
+    }
+  }
+  __count(&walk->progress.directories);
+  name = strrchr(job->path, '/');
+  name = (name == NULL) ? job->path : name + 1;
+  if(__selected(walk, job->path, name)){
+    if(__apply_fd(fd, (job->path[0] == '\0') ? "." : job->path, walk->config) < 0)
+      __report_error(walk, job->path, errno);
+    else
+      __count(&walk->progress.updated);
+  }else
+    __count(&walk->progress.skipped);
+  dir = fdopendir(fd); // takes ownership of fd
+  if(dir == NULL){
+    __report_error(walk, job->path, errno);
+    close(fd);
+    goto out;
+  }
+  while((d = readdir(dir)) != NULL){
+    if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+      continue;
+    __visit_entry(walk, dirfd(dir), job->path, d);
+  }
+  closedir(dir);
+out:
+  free(job->path);
+  free(job);
+}
+
+int provenance_tree_apply(const char* root, const struct tree_config* config, struct tree_progress* progress){
+  struct tree_walk walk;
+  struct stat st;
+  long threads;
+  char* path;
+  int fd;
+  int rc;
+
+  if(config->op == TREE_LABEL && config->label == NULL)
+    return -EINVAL;
+  if(config->op == TREE_READ && config->inode == NULL)
+    return -EINVAL;
+  memset(&walk, 0, sizeof(struct tree_walk));
+  walk.config = config;
+  walk.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(walk.root_fd < 0){
+    if(errno != ENOTDIR)
+      return -errno;
+    // a single file
+    fd = open(root, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0)
+      return -errno;
+    rc = __apply_fd(fd, root, config);
+    rc = (rc < 0) ? -errno : 0;
+    close(fd);
+    if(progress != NULL){
+      memset(progress, 0, sizeof(struct tree_progress));
+      progress->entries = 1;
+      progress->updated = (rc == 0);
+    }
+    return rc;
+  }
+  if(fstat(walk.root_fd, &st) < 0){
+    rc = -errno;
+    close(walk.root_fd);
+    return rc;
+  }
+  walk.dev = st.st_dev;
+  walk.next_report = config->progress_interval ? config->progress_interval : TREE_PROGRESS_INTERVAL;
+  threads = config->threads;
+  if(threads == 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads <= 0)
+    threads = 1;
+  walk.pool = thpool_init(threads);
+  if(walk.pool == NULL){
+    close(walk.root_fd);
+    return -ENOMEM;
+  }
+  pthread_mutex_init(&walk.lock, NULL);
+  path = strdup("");
+  if(path == NULL)
+    rc = -ENOMEM;
+  else{
+    __queue_directory(&walk, path);
+    thpool_wait(walk.pool); // jobs queue their subdirectories, returns once all are done
+    rc = 0;
+  }
+  if(config->progress != NULL){
+    __snapshot(&walk, &walk.progress);
+    config->progress(&walk.progress, config->data);
+  }
+  thpool_destroy(walk.pool);
+  close(walk.root_fd);
+  pthread_mutex_destroy(&walk.lock);
+  if(progress != NULL)
+    __snapshot(&walk, progress);
+  if(rc < 0)
+    return rc;
+  return (int)((walk.progress.errors > INT32_MAX) ? INT32_MAX : walk.progress.errors);
+}
+
+/*
+* Process selection only collects pids, the change itself is applied in
+* batches by provenance_processes_apply.
+*/
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+struct pid_set{
+  uint32_t* pids;
+  size_t count;
+  size_t size;
+};
+
+static int __pid_add(struct pid_set* set, uint32_t pid){
+  uint32_t* tmp;
+
+  if(set->count == set->size){
+    set->size = (set->size == 0) ? 256 : set->size*2;
+    tmp = realloc(set->pids, set->size*sizeof(uint32_t));
+    if(tmp == NULL)
+      return -ENOMEM;
+    set->pids = tmp;
+  }
+  set->pids[set->count++] = pid;
+  return 0;
+}
+
+static int __process_apply(struct pid_set* set, const struct process_config* config){
+  int* results = NULL;
+  size_t i;
+  int rc;
+
+  if(set->count == 0)
+    return 0;
+  if(config->result != NULL){
+    results = calloc(set->count, sizeof(int));
+    if(results == NULL)
+      return -ENOMEM;
+  }
+  rc = provenance_processes_apply(set->pids, set->count, config->op, config->value, config->label, results);
+  if(rc >= 0 && results != NULL){
+    for(i = 0; i < set->count; i++)
+      config->result(set->pids[i], -results[i], config->data);
+  }
+  free(results);
+  return rc;
+}
+
+/* read a small /proc or cgroupfs file, return its length or -1 */
+static ssize_t __read_small(int dirfd, const char* name, char* buf, size_t length){
+  ssize_t rc;
+  int fd;
+
+  fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return -1;
+  rc = read(fd, buf, length - 1);
+  close(fd);
+  if(rc >= 0)
+    buf[rc] = '\0';
+  return rc;
+}
+
+static int __cgroup_collect(int cgfd, struct pid_set* set){
+  char buf[4096];
+  size_t kept = 0;
+  struct dirent* d;
+  DIR* dir;
+  ssize_t len;
+  char* p;
+  char* end;
+  int fd;
+  int rc = 0;
+
+  fd = openat(cgfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return -errno;
+  // a pid may straddle two reads, the tail of a buffer is kept for the next
+  while((len = read(fd, buf + kept, sizeof(buf) - kept - 1)) > 0){
+    len += kept;
+    buf[len] = '\0';
+    p = buf;
+    while((end = strchr(p, '\n')) != NULL){
+      *end = '\0';
+      if(*p != '\0' && (rc = __pid_add(set, strtoul(p, NULL, 10))) < 0)
+        goto out;
+      p = end + 1;
+    }
+    kept = strlen(p);
+    if(kept >= 16){
+      rc = -EINVAL;
+      goto out;
+    }
+    memmove(buf, p, kept);
+  }
+  if(len < 0){
+    rc = -errno;
+    goto out;
+  }
+  if(kept > 0){
+    buf[kept] = '\0';
+    if((rc = __pid_add(set, strtoul(buf, NULL, 10))) < 0)
+      goto out;
+  }
+  close(fd);
+  fd = dup(cgfd);
+  if(fd < 0)
+    return -errno;
+  dir = fdopendir(fd);
+  if(dir == NULL){
+    close(fd);
+    return -errno;
+  }
+  while((d = readdir(dir)) != NULL){
+    if(d->d_type != DT_DIR || d->d_name[0] == '.')
+      continue;
+    fd = openat(dirfd(dir), d->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+      continue; // removed meanwhile
+    rc = __cgroup_collect(fd, set);
+    close(fd);
+    if(rc < 0 && rc != -ENOENT)
+      break;
+    rc = 0;
+  }
+  closedir(dir);
+  return rc;
+out:
+  close(fd);
+  return rc;
+}
+
+int provenance_cgroup_apply(const char* cgroup, const struct process_config* config){
+  struct pid_set set;
+  char path[PATH_MAX];
+  int fd;
+  int rc;
+
+  if(config->op == PROCESS_LABEL && config->label == NULL)
+    return -EINVAL;
+  if(strncmp(cgroup, CGROUP_ROOT "/", sizeof(CGROUP_ROOT)) != 0){
+    if(snprintf(path, sizeof(path), "%s/%s", CGROUP_ROOT, cgroup) >= (int)sizeof(path))
+      return -ENAMETOOLONG;
+    cgroup = path;
+  }
+  fd = open(cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd < 0)
+    return -errno;
+  memset(&set, 0, sizeof(struct pid_set));
+  rc = __cgroup_collect(fd, &set);
+  close(fd);
+  if(rc == 0)
+    rc = __process_apply(&set, config);
+  free(set.pids);
+  return rc;
+}
+
+static inline uint64_t __ns_inode(int pidfd, const char* name){
+  struct stat st;
+
+  if(fstatat(pidfd, name, &st, 0) < 0)
+    return 0;
+  return st.st_ino;
+}
+
+static int __process_info(int pidfd, struct process_info* info){
+  char buf[4096];
+  char* p;
+
+  if(__read_small(pidfd, "status", buf, sizeof(buf)) < 0)
+    return -errno;
+  p = strstr(buf, "\nUid:");
+  if(p == NULL || sscanf(p, "\nUid: %u", &info->uid) != 1)
+    return -EINVAL;
+  p = strstr(buf, "\nGid:");
+  if(p == NULL || sscanf(p, "\nGid: %u", &info->gid) != 1)
+    return -EINVAL;
+  if(__read_small(pidfd, "comm", buf, sizeof(info->comm) + 1) < 0)
+    return -errno;
+  p = strchr(buf, '\n');
+  if(p != NULL)
+    *p = '\0';
+  strncpy(info->comm, buf, sizeof(info->comm) - 1);
+  info->comm[sizeof(info->comm) - 1] = '\0';
+  info->pidns = __ns_inode(pidfd, "ns/pid");
+  info->mntns = __ns_inode(pidfd, "ns/mnt");
+  info->netns = __ns_inode(pidfd, "ns/net");
+  info->ipcns = __ns_inode(pidfd, "ns/ipc");
+  info->utsns = __ns_inode(pidfd, "ns/uts");
+  info->userns = __ns_inode(pidfd, "ns/user");
+  info->cgroupns = __ns_inode(pidfd, "ns/cgroup");
+  return 0;
+}
+
+int provenance_select_apply(bool (*select)(const struct process_info* info, void* data), const struct process_config* config){
+  struct process_info info;
+  struct pid_set set;
+  struct dirent* d;
+  DIR* proc;
+  char* end;
+  unsigned long pid;
+  int pidfd;
+  int rc = 0;
+
+  if(config->op == PROCESS_LABEL && config->label == NULL)
+    return -EINVAL;
+  proc = opendir("/proc");
+  if(proc == NULL)
+    return -errno;
+  memset(&set, 0, sizeof(struct pid_set));
+  while((d = readdir(proc)) != NULL){
+    pid = strtoul(d->d_name, &end, 10);
+    if(*end != '\0' || pid == 0)
+      continue;
+    pidfd = openat(dirfd(proc), d->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(pidfd < 0)
+      continue; // exited
+    memset(&info, 0, sizeof(struct process_info));
+    info.pid = pid;
+    rc = __process_info(pidfd, &info);
+    close(pidfd);
+    if(rc < 0){
+      rc = 0;
+      continue;
+    }
+    if(select(&info, config->data) && (rc = __pid_add(&set, pid)) < 0)
+      break;
+  }
+  closedir(proc);
+  if(rc == 0)
+    rc = __process_apply(&set, config);
+  free(set.pids);
+  return rc;
+}
+
+/*
+* Identifier lookups are split in contiguous chunks, one job each, so that
+* entries of a chunk are written next to each other in the arena. Small
+* batches are resolved in the calling thread.
+*/
+#define FILE_ID_CHUNK 256
+
+struct file_id_job{
+  const char** paths;       // NULL when resolving descriptors
+  const int* fds;
+  size_t start;
+  size_t end;
+  char* arena;
+  int* errors;
+  uint64_t* failed;
+};
+
+static void file_id_job(void* data){
+  struct file_id_job* job = (struct file_id_job*)data;
+  char* id;
+  size_t i;
+  int rc;
+
+  for(i = job->start; i < job->end; i++){
+    id = job->arena + i*PROV_FILE_ID_LEN;
+    if(job->paths != NULL)
+      rc = provenance_file_id(job->paths[i], id, PROV_FILE_ID_LEN);
+    else
+      rc = fprovenance_file_id(job->fds[i], id, PROV_FILE_ID_LEN);
+    if(rc < 0){
+      rc = (rc == -1) ? -errno : rc;
+      id[0] = '\0';
+      __count(job->failed);
+    }
+    if(job->errors != NULL)
+      job->errors[i] = rc;
+  }
+}
+
+static int __file_ids(const char** paths, const int* fds, size_t count, char* arena, int* errors, uint32_t threads){
+  struct file_id_job* jobs;
+  struct file_id_job single;
+  threadpool pool;
+  uint64_t failed = 0;
+  size_t njobs;
+  size_t chunk;
+  size_t i;
+  long n = threads;
+
+  if(n == 0)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+  if(n <= 0)
+    n = 1;
+  // a few chunks per thread so that slow entries do not stall a worker
+  chunk = count/(n*4);
+  if(chunk < FILE_ID_CHUNK)
+    chunk = FILE_ID_CHUNK;
+  njobs = (count + chunk - 1)/chunk;
+  if(n == 1 || njobs <= 1){
+    single.paths = paths;
+    single.fds = fds;
+    single.start = 0;
+    single.end = count;
+    single.arena = arena;
+    single.errors = errors;
+    single.failed = &failed;
+    file_id_job(&single);
+    return (failed > INT32_MAX) ? INT32_MAX : (int)failed;
+  }
+  if((size_t)n > njobs)
+    n = njobs;
+  jobs = calloc(njobs, sizeof(struct file_id_job));
+  if(jobs == NULL)
+    return -ENOMEM;
+  pool = thpool_init(n);
+  if(pool == NULL){
+    free(jobs);
+    return -ENOMEM;
+  }
+  for(i = 0; i < njobs; i++){
+    jobs[i].paths = paths;
+    jobs[i].fds = fds;
+    jobs[i].start = i*chunk;
+    jobs[i].end = (i + 1)*chunk < count ? (i + 1)*chunk : count;
+    jobs[i].arena = arena;
+    jobs[i].errors = errors;
+    jobs[i].failed = &failed;
+    if(thpool_add_work(pool, file_id_job, &jobs[i]) != 0)
+      file_id_job(&jobs[i]);
+  }
+  thpool_wait(pool);
+  thpool_destroy(pool);
+  free(jobs);
+  return (failed > INT32_MAX) ? INT32_MAX : (int)failed;
+}
+
+int provenance_file_ids(const char** paths, size_t count, char* arena, int* errors, uint32_t threads){
+  return __file_ids(paths, NULL, count, arena, errors, threads);
+}
+
+int fprovenance_file_ids(const int* fds, size_t count, char* arena, int* errors, uint32_t threads){
+  return __file_ids(NULL, fds, count, arena, errors, threads);
+}
@@ -31,13 +31,8 @@
 
 static inline int __provenance_change_filter( bool add, const char* file, uint64_t filter, uint64_t mask ){
   struct prov_filter f;
-  int fd = open(file, O_WRONLY);
   int rc;
 
-  if(fd<0)
-  {
-    return fd;
-  }
   f.filter=filter;
   f.mask=mask;
   if(add){
@@ -46,8 +41,7 @@ static inline int __provenance_change_filter( bool add, const char* file, uint64
     f.add=0;
   }
 
-  rc = write(fd, &f, sizeof(struct prov_filter));
-  close(fd);
+  rc = provenance_control_write(file, &f, sizeof(struct prov_filter));
   if(rc<0){
     return rc;
   }
@@ -55,15 +49,9 @@ static inline int __provenance_change_filter( bool add, const char* file, uint64
 }
 
 static inline int __provenance_get_filter( const char* file, uint64_t* filter ){
-  int fd = open(file, O_RDONLY);
   int rc;
-  if(fd<0)
-  {
-    return fd;
-  }
 
-  rc = read(fd, filter, sizeof(uint64_t));
-  close(fd);
+  rc = provenance_control_read(file, filter, sizeof(uint64_t));
   if(rc<0){
     return rc;
   }
@@ -0,0 +1,613 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/provenance_types.h>
+
+#include "thpool.h"
+#include "provenancegraph.h"
+
+/*
+* The node table is a fixed open addressing table (linear probing, nothing is
+* ever removed), so a node index is stable and edges refer to nodes by index.
+* Adjacency lists are chains of 128 bytes blocks taken from an arena reserved
+* at start and touched as it is used; a node points to its most recent block,
+* which is the one being filled. A quarter of the budget goes to the node
+* table, kept under 3/4 load. Relations carry the time they were first and
+* last recorded (seconds), repeats only move the latter.
+*
+* The node table is split in GRAPH_SHARDS ranges of slots: a node is probed
+* for within the range of its home slot and is only changed (with its
+* adjacency lists) under the lock of that range; a relation takes the locks
+* of both ends, lowest first. Entries are published with release stores
+* (a node's type, a block's count, a list head) and never removed, queries
+* read them without the shard locks. l_graph only guards the lifetime of the
+* tables: recording and queries take it shared, start and stop exclusive.
+*/
+#define GRAPH_MIN_MEMORY  (1024*1024)
+#define GRAPH_BLOCK_EDGES 7
+#define GRAPH_NO_SUBTYPE  0xFFFF
+#define GRAPH_SHARDS      64
+
+struct graph_node{
+  uint64_t id;
+  uint64_t type;        // 0 for an empty slot
+  uint32_t boot_id;
+  uint32_t version;     // latest seen
+  uint32_t out;         // head block + 1, 0 when none
+  uint32_t in;
+};
+
+struct graph_edge{
+  uint32_t node;        // index of the other end
+  uint32_t type;        // relation type, packed
+  uint32_t first;
+  uint32_t last;
+};
+
+struct graph_block{
+  uint32_t next;        // older block + 1, 0 when none
+  uint32_t count;
+  struct graph_edge edges[GRAPH_BLOCK_EDGES];
+  uint32_t pad[2];      // 128 bytes
+};
+
+struct graph_shard{
+  pthread_mutex_t lock;
+  uint32_t nodes;
+} __attribute__((aligned(64)));
+
+static struct graph_node* nodes = NULL;
+static uint32_t node_slots;     // power of 2
+static uint32_t shard_slots;    // node_slots/GRAPH_SHARDS
+static uint32_t shard_max;      // load limit, per shard
+static struct graph_shard shards[GRAPH_SHARDS];
+static struct graph_block* blocks = NULL;
+static uint32_t block_max;
+static uint32_t block_next;     // taken atomically
+static struct graph_stats stats; // updated atomically
+static uint32_t generation;     // bumped by start, queries detect a restart
+static pthread_rwlock_t l_graph = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline void __stat_add(uint64_t* counter, uint64_t v){
+  __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+/* types are a category (top 16 bits) and a single subtype bit */
+static inline uint32_t __pack_type(uint64_t type){
+  uint64_t sub = type & SUBTYPE_MASK;
+
+  return (uint32_t)((type >> 48) << 16) | ((sub == 0) ? GRAPH_NO_SUBTYPE : (uint32_t)__builtin_ctzll(sub));
+}
+
+static inline uint64_t __unpack_type(uint32_t packed){
+  uint64_t type = (uint64_t)(packed >> 16) << 48;
+
+  if((packed & 0xFFFF) != GRAPH_NO_SUBTYPE)
+    type |= 1ULL << (packed & 0xFFFF);
+  return type;
+}
+
+/* home slot */
+static inline uint32_t __node_hash(uint64_t id, uint32_t boot_id){
+  uint64_t h = (id ^ ((uint64_t)boot_id << 32)) * 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(h >> 32) & (node_slots-1);
+}
+
+/* probing wraps within the shard of the home slot */
+static inline uint32_t __node_next(uint32_t i){
+  return (i & ~(shard_slots-1)) | ((i + 1) & (shard_slots-1));
+}
+
+static inline struct graph_shard* __node_shard(const struct node_identifier* id){
+  return &shards[__node_hash(id->id, id->boot_id)/shard_slots];
+}
+
+/* return the node index or -1, no lock needed */
+static int64_t __node_find(uint64_t id, uint32_t boot_id){
+  uint32_t i = __node_hash(id, boot_id);
+
+  while(__atomic_load_n(&nodes[i].type, __ATOMIC_ACQUIRE) != 0){
+    if(nodes[i].id == id && nodes[i].boot_id == boot_id)
+      return i;
+    i = __node_next(i);
+  }
+  return -1;
+}
+
+/* called with the lock of the node's shard held, return the node index or -1 if full */
+static int64_t __node_get(const struct node_identifier* id){
+  struct graph_shard* shard = __node_shard(id);
+  uint32_t i = __node_hash(id->id, id->boot_id);
+
+  if(id->type == 0){ // would read as an empty slot
+    __stat_add(&stats.dropped_nodes, 1);
+    return -1;
+  }
+  while(nodes[i].type != 0){
+    if(nodes[i].id == id->id && nodes[i].boot_id == id->boot_id){
+      if(id->version > nodes[i].version)
+        __atomic_store_n(&nodes[i].version, id->version, __ATOMIC_RELAXED);
+      return i;
+    }
+    i = __node_next(i);
+  }
+  if(shard->nodes >= shard_max){
+    __stat_add(&stats.dropped_nodes, 1);
+    return -1;
+  }
+  nodes[i].id = id->id;
+  nodes[i].boot_id = id->boot_id;
+  nodes[i].version = id->version;
+  __atomic_store_n(&nodes[i].type, id->type, __ATOMIC_RELEASE); // publish
+  shard->nodes++;
+  __stat_add(&stats.nodes, 1);
+  return i;
+}
+
+static inline void __lock_pair(struct graph_shard* a, struct graph_shard* b){
+  if(a > b){
+    pthread_mutex_lock(&b->lock);
+    pthread_mutex_lock(&a->lock);
+  }else{
+    pthread_mutex_lock(&a->lock);
+    if(b != a)
+      pthread_mutex_lock(&b->lock);
+  }
+}
+
+static inline void __unlock_pair(struct graph_shard* a, struct graph_shard* b){
+  pthread_mutex_unlock(&a->lock);
+  if(b != a)
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* return a block index + 1, 0 when the arena is exhausted */
+static inline uint32_t __block_alloc(void){
+  uint32_t n = __atomic_load_n(&block_next, __ATOMIC_RELAXED);
+
+  do{
+    if(n == block_max)
+      return 0;
+  }while(!__atomic_compare_exchange_n(&block_next, &n, n + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  __stat_add(&stats.memory, sizeof(struct graph_block));
+  return n + 1;
+}
+
+/* called with the lock of the shard owning head held, return 1 if added, 0 if merged, -1 if full */
+static int __edge_add(uint32_t* head, uint32_t node, uint32_t type, uint32_t now){
+  struct graph_block* b = (*head != 0) ? &blocks[*head - 1] : NULL;
+  uint32_t n;
+  uint32_t i;
+
+  if(b != NULL){
+    for(i = 0; i < b->count; i++){ // repeated relations are usually recent
+      if(b->edges[i].node == node && b->edges[i].type == type){
+        __atomic_store_n(&b->edges[i].last, now, __ATOMIC_RELAXED);
+        return 0;
+      }
+    }
+  }
+  if(b == NULL || b->count == GRAPH_BLOCK_EDGES){
+    n = __block_alloc();
+    if(n == 0)
+      return -1;
+    b = &blocks[n - 1];
+    b->next = *head;
+    b->count = 0;
+    __atomic_store_n(head, n, __ATOMIC_RELEASE);
+  }
+  b->edges[b->count].node = node;
+  b->edges[b->count].type = type;
+  b->edges[b->count].first = now;
+  b->edges[b->count].last = now;
+  __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+int provenance_graph_start(size_t memory){
+  size_t table;
+  uint32_t i;
+
+  if(memory < GRAPH_MIN_MEMORY)
+    return -EINVAL;
+  pthread_rwlock_wrlock(&l_graph);
+  if(nodes != NULL){
+    pthread_rwlock_unlock(&l_graph);
+    return -EBUSY;
+  }
+  for(node_slots = GRAPH_SHARDS; (size_t)node_slots*2*sizeof(struct graph_node) <= memory/4; node_slots *= 2);
+  table = (size_t)node_slots*sizeof(struct graph_node);
+  block_max = ((memory - table)/sizeof(struct graph_block) > UINT32_MAX - 1) ? UINT32_MAX - 1 : (memory - table)/sizeof(struct graph_block);
+  nodes = calloc(node_slots, sizeof(struct graph_node));
+  blocks = malloc((size_t)block_max*sizeof(struct graph_block)); // pages are only backed once used
+  if(nodes == NULL || blocks == NULL){
+    free(nodes);
+    free(blocks);
+    nodes = NULL;
+    blocks = NULL;
+    pthread_rwlock_unlock(&l_graph);
+    return -ENOMEM;
+  }
+  shard_slots = node_slots/GRAPH_SHARDS;
+  shard_max = shard_slots - shard_slots/4;
+  for(i = 0; i < GRAPH_SHARDS; i++){ // not in use, recording waits for l_graph
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].nodes = 0;
+  }
+  block_next = 0;
+  generation++;
+  memset(&stats, 0, sizeof(struct graph_stats));
+  stats.memory = table;
+  stats.capacity = table + (uint64_t)block_max*sizeof(struct graph_block);
+  pthread_rwlock_unlock(&l_graph);
+  return 0;
+}
+
+void provenance_graph_stop(void){
+  pthread_rwlock_wrlock(&l_graph);
+  free(nodes);
+  free(blocks);
+  nodes = NULL;
+  blocks = NULL;
+  pthread_rwlock_unlock(&l_graph);
+}
+
+void provenance_graph_stats(struct graph_stats* s){
+  pthread_rwlock_rdlock(&l_graph);
+  s->nodes = __atomic_load_n(&stats.nodes, __ATOMIC_RELAXED);
+  s->edges = __atomic_load_n(&stats.edges, __ATOMIC_RELAXED);
+  s->merged_edges = __atomic_load_n(&stats.merged_edges, __ATOMIC_RELAXED);
+  s->dropped_nodes = __atomic_load_n(&stats.dropped_nodes, __ATOMIC_RELAXED);
+  s->dropped_edges = __atomic_load_n(&stats.dropped_edges, __ATOMIC_RELAXED);
+  s->memory = __atomic_load_n(&stats.memory, __ATOMIC_RELAXED);
+  s->capacity = stats.capacity;
+  pthread_rwlock_unlock(&l_graph);
+}
+
+static void __graph_relation(const struct relation_struct* relation){
+  uint32_t type = __pack_type(relation->identifier.relation_id.type);
+  struct graph_shard* snd_shard;
+  struct graph_shard* rcv_shard;
+  struct timespec ts;
+  int64_t snd;
+  int64_t rcv;
+  int rc;
+
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+  pthread_rwlock_rdlock(&l_graph);
+  if(nodes == NULL){
+    pthread_rwlock_unlock(&l_graph);
+    return;
+  }
+  snd_shard = __node_shard(&relation->snd.node_id);
+  rcv_shard = __node_shard(&relation->rcv.node_id);
+  __lock_pair(snd_shard, rcv_shard);
+  snd = __node_get(&relation->snd.node_id);
+  rcv = __node_get(&relation->rcv.node_id);
+  if(snd < 0 || rcv < 0){
+    __stat_add(&stats.dropped_edges, 1);
+    goto out;
+  }
+  if(snd == rcv) // between versions of the same object
+    goto out;
+  /*
+  * the sending side decides whether this is a repeat. When the receiving side
+  * no longer has the relation in its current block it is added again, so
+  * times seen from either side are right; traversals visit nodes once anyway.
+  */
+  rc = __edge_add(&nodes[snd].out, rcv, type, ts.tv_sec);
+  if(rc >= 0 && __edge_add(&nodes[rcv].in, snd, type, ts.tv_sec) < 0){
+    if(rc > 0) // the relation was the last one added
+      __atomic_fetch_sub(&blocks[nodes[snd].out - 1].count, 1, __ATOMIC_RELEASE);
+    rc = -1;
+  }
+  if(rc < 0)
+    __stat_add(&stats.dropped_edges, 1);
+  else if(rc == 0)
+    __stat_add(&stats.merged_edges, 1);
+  else
+    __stat_add(&stats.edges, 1);
+out:
+  __unlock_pair(snd_shard, rcv_shard);
+  pthread_rwlock_unlock(&l_graph);
+}
+
+static void __graph_node(const struct node_identifier* id){
+  struct graph_shard* shard;
+
+  pthread_rwlock_rdlock(&l_graph);
+  if(nodes != NULL){
+    shard = __node_shard(id);
+    pthread_mutex_lock(&shard->lock);
+    __node_get(id);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  pthread_rwlock_unlock(&l_graph);
+}
+
+void provenance_graph_record(const union prov_elt* msg){
+  if(nodes == NULL) // unlocked check, the graph is set up at startup
+    return;
+  if(prov_is_relation(msg))
+    __graph_relation(&msg->relation_info);
+  else
+    __graph_node(&msg->node_info.identifier.node_id);
+}
+
+void provenance_graph_long_record(const union long_prov_elt* msg){
+  if(nodes == NULL)
+    return;
+  __graph_node(&msg->node_info.identifier.node_id);
+}
+
+static inline void __node_identifier(uint32_t i, struct node_identifier* id){
+  memset(id, 0, sizeof(struct node_identifier));
+  id->type = nodes[i].type;
+  id->id = nodes[i].id;
+  id->boot_id = nodes[i].boot_id;
+  id->version = __atomic_load_n(&nodes[i].version, __ATOMIC_RELAXED);
+}
+
+int provenance_graph_node(uint64_t id, uint32_t boot_id, struct node_identifier* node){
+  int64_t i;
+  int rc = -ENOENT;
+
+  pthread_rwlock_rdlock(&l_graph);
+  if(nodes != NULL && (i = __node_find(id, boot_id)) >= 0){
+    __node_identifier(i, node);
+    rc = 0;
+  }
+  pthread_rwlock_unlock(&l_graph);
+  return rc;
+}
+
+ssize_t provenance_graph_edges(const struct node_identifier* node, bool out, struct graph_edge_info* edges, size_t count){
+  struct graph_block* b;
+  uint32_t head;
+  ssize_t n = 0;
+  int64_t i;
+  uint32_t j;
+
+  pthread_rwlock_rdlock(&l_graph);
+  if(nodes == NULL || (i = __node_find(node->id, node->boot_id)) < 0){
+    pthread_rwlock_unlock(&l_graph);
+    return -ENOENT;
+  }
+  head = __atomic_load_n(out ? &nodes[i].out : &nodes[i].in, __ATOMIC_ACQUIRE);
+  for(; head != 0; head = b->next){
+    b = &blocks[head - 1];
+    for(j = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE); j > 0; j--, n++){
+      if((size_t)n >= count)
+        continue;
+      __node_identifier(b->edges[j-1].node, &edges[n].node);
+      edges[n].type = __unpack_type(b->edges[j-1].type);
+      edges[n].first = b->edges[j-1].first;
+      edges[n].last = __atomic_load_n(&b->edges[j-1].last, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_rwlock_unlock(&l_graph);
+  return n;
+}
+
+/*
+* Lineage queries are level by level breadth first traversals. l_graph is
+* taken for each level (shared with recording), node indices being stable
+* the frontier carries over as long as the graph was not restarted. The
+* visited set is a bitset over node slots set atomically, so that the nodes
+* of a level can be expanded by several jobs, each building its own part of
+* the next level. Small levels are expanded in the calling thread.
+*/
+#define LINEAGE_PARALLEL  1024
+#define LINEAGE_CHUNK     256
+
+struct lineage_level{
+  uint32_t* nodes;
+  size_t count;
+  size_t size;
+};
+
+struct lineage_job{
+  const struct lineage_query* query;
+  uint64_t* visited;
+  const uint32_t* frontier;
+  size_t start;
+  size_t end;
+  struct lineage_level next;
+  int err;
+};
+
+static inline int __level_add(struct lineage_level* level, uint32_t node){
+  uint32_t* tmp;
+
+  if(level->count == level->size){
+    tmp = realloc(level->nodes, (level->size ? level->size*2 : 64)*sizeof(uint32_t));
+    if(tmp == NULL)
+      return -ENOMEM;
+    level->nodes = tmp;
+    level->size = level->size ? level->size*2 : 64;
+  }
+  level->nodes[level->count++] = node;
+  return 0;
+}
+
+static inline bool __edge_match(const struct graph_edge* e, const struct lineage_query* query){
+  uint32_t sub = e->type & 0xFFFF;
+
+  if(query->relation_types != 0
+    && (sub == GRAPH_NO_SUBTYPE || (query->relation_types & (1ULL << sub)) == 0))
+    return false;
+  if(__atomic_load_n(&e->last, __ATOMIC_RELAXED) < query->since)
+    return false;
+  if(query->until != 0 && e->first > query->until)
+    return false;
+  return true;
+}
+
+/* return true if the node was not visited yet */
+static inline bool __visit(uint64_t* visited, uint32_t node){
+  uint64_t bit = 1ULL << (node & 63);
+
+  return (__atomic_fetch_or(&visited[node >> 6], bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+static void lineage_job(void* data){
+  struct lineage_job* job = (struct lineage_job*)data;
+  struct graph_block* b;
+  struct graph_edge* e;
+  uint32_t head;
+  uint32_t node;
+  uint32_t count;
+  size_t i;
+  uint32_t j;
+
+  for(i = job->start; i < job->end; i++){
+    node = job->frontier[i];
+    head = __atomic_load_n((job->query->direction == LINEAGE_FORWARD) ? &nodes[node].out : &nodes[node].in, __ATOMIC_ACQUIRE);
+    for(; head != 0; head = b->next){
+      b = &blocks[head - 1];
+      count = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+      for(j = 0; j < count; j++){
+        e = &b->edges[j];
+        if(!__edge_match(e, job->query) || !__visit(job->visited, e->node))
+          continue;
+        if(__level_add(&job->next, e->node) < 0){
+          job->err = -ENOMEM;
+          return;
+        }
+      }
+    }
+  }
+}
+
+ssize_t provenance_graph_lineage(const struct node_identifier* start, const struct lineage_query* query, struct lineage_result* results, size_t count){
+  struct lineage_level frontier = {NULL, 0, 0};
+  struct lineage_job* jobs = NULL;
+  struct lineage_job* tmp;
+  threadpool pool = NULL;
+  uint64_t* visited = NULL;
+  size_t njobs_max = 0;
+  size_t njobs;
+  size_t chunk;
+  size_t i;
+  size_t k;
+  uint32_t depth;
+  uint32_t node;
+  ssize_t n = 0;
+  int64_t s = -1;
+  uint32_t slots = 0;
+  uint32_t gen = 0;
+  long threads = query->threads;
+
+  if(threads == 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads <= 0)
+    threads = 1;
+
+  pthread_rwlock_rdlock(&l_graph);
+  if(nodes != NULL && (s = __node_find(start->id, start->boot_id)) >= 0){
+    slots = node_slots;
+    gen = generation;
+  }
+  pthread_rwlock_unlock(&l_graph);
+  if(s < 0)
+    return -ENOENT;
+  visited = calloc((slots + 63)/64, sizeof(uint64_t));
+  if(visited == NULL || __level_add(&frontier, s) < 0){
+    n = -ENOMEM;
+    goto out;
+  }
+  __visit(visited, s);
+
+  for(depth = 1; frontier.count > 0 && (query->depth == 0 || depth <= query->depth); depth++){
+    // a few chunks per thread so that high degree nodes do not stall a worker
+    chunk = frontier.count;
+    if(threads > 1 && frontier.count >= LINEAGE_PARALLEL){
+      chunk = frontier.count/(threads*4);
+      if(chunk < LINEAGE_CHUNK)
+        chunk = LINEAGE_CHUNK;
+      if(pool == NULL) // created outside l_graph
+        pool = thpool_init(threads);
+    }
+    njobs = (frontier.count + chunk - 1)/chunk;
+    if(njobs > njobs_max){
+      tmp = realloc(jobs, njobs*sizeof(struct lineage_job));
+      if(tmp == NULL){
+        n = -ENOMEM;
+        goto out;
+      }
+      jobs = tmp;
+      memset(&jobs[njobs_max], 0, (njobs - njobs_max)*sizeof(struct lineage_job));
+      njobs_max = njobs;
+    }
+    pthread_rwlock_rdlock(&l_graph);
+    if(nodes == NULL || generation != gen){ // stopped or restarted since the last level
+      n = -ENOENT;
+      goto unlock;
+    }
+    for(i = 0; i < njobs; i++){
+      jobs[i].query = query;
+      jobs[i].visited = visited;
+      jobs[i].frontier = frontier.nodes;
+      jobs[i].start = i*chunk;
+      jobs[i].end = (i + 1)*chunk < frontier.count ? (i + 1)*chunk : frontier.count;
+      jobs[i].next.count = 0;
+      jobs[i].err = 0;
+      // run in this thread when there is nothing to share or no pool
+      if(njobs == 1 || pool == NULL || thpool_add_work(pool, lineage_job, &jobs[i]) != 0)
+        lineage_job(&jobs[i]);
+    }
+    if(njobs > 1 && pool != NULL)
+      thpool_wait(pool);
+
+    frontier.count = 0;
+    for(i = 0; i < njobs; i++){
+      if(jobs[i].err < 0){
+        n = jobs[i].err;
+        goto unlock;
+      }
+      for(k = 0; k < jobs[i].next.count; k++){
+        node = jobs[i].next.nodes[k];
+        if(__level_add(&frontier, node) < 0){
+          n = -ENOMEM;
+          goto unlock;
+        }
+        if(query->node_types != 0 && (__atomic_load_n(&nodes[node].type, __ATOMIC_RELAXED) & SUBTYPE_MASK & query->node_types) == 0)
+          continue;
+        if((size_t)n < count){
+          __node_identifier(node, &results[n].node);
+          results[n].depth = depth;
+        }
+        n++;
+      }
+    }
+    pthread_rwlock_unlock(&l_graph);
+  }
+  goto out;
+unlock:
+  pthread_rwlock_unlock(&l_graph);
+out:
+  if(pool != NULL)
+    thpool_destroy(pool);
+  for(i = 0; i < njobs_max; i++)
+    free(jobs[i].next.nodes);
+  free(jobs);
+  free(frontier.nodes);
+  free(visited);
+  return n;
+}
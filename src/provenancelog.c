@@ -0,0 +1,743 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/provenance_types.h>
+
+#include "provenanceutils.h"
+#include "provenancelog.h"
+
+/*
+* File layout, integers little endian; records are kernel structures in the
+* writer's byte order:
+*   file header: "CFLOG001" magic, sizeof(union prov_elt) and
+*     sizeof(union long_prov_elt) as uint32_t, then LOG_BYTE_ORDER in the
+*     writer's byte order (and padding)
+*   blocks: block header followed by a compressed frame (see
+*     compress_stream_frame) of records, each record prefixed by its length
+*     and padding (8 bytes, keeps records aligned once decompressed)
+*   index (once closed): a copy of every block header with its offset,
+*     then a footer pointing to it
+* Reopening a closed log for writing drops the index, it is written again on
+* close.
+*/
+#define LOG_MAGIC             "CFLOG001"
+#define LOG_MAGIC_LENGTH      8
+#define LOG_INDEX_MAGIC       "CFLOGIDX"
+#define LOG_BLOCK_MAGIC       0x424C4643 // "CFLB"
+#define LOG_BYTE_ORDER        0x01020304 // reads 0x04030201 on the other order
+#define LOG_RECORD_HEADER     (2*sizeof(uint32_t))
+#define LOG_INDEX_INITIAL     64
+
+struct log_file_header{
+  char magic[LOG_MAGIC_LENGTH];
+  uint32_t elt_size;
+  uint32_t long_elt_size;
+  uint32_t byte_order;      // host order
+  uint32_t pad;
+};
+
+struct log_block_header{
+  uint32_t magic;
+  uint32_t count;           // records
+  uint32_t length;          // of the compressed frame
+  uint32_t crc;             // crc32 of the compressed frame
+  uint64_t jiffies_min;
+  uint64_t jiffies_max;
+  uint64_t node_types;      // subtypes present
+  uint64_t relation_types;
+  uint32_t machine_id;      // blocks never mix machines
+  uint32_t pad;
+};
+
+struct log_index_entry{
+  uint64_t offset;          // of the block header
+  struct log_block_header header;
+};
+
+struct log_footer{
+  uint64_t index_offset;
+  uint32_t blocks;
+  uint32_t crc;             // crc32 of the index
+  char magic[LOG_MAGIC_LENGTH];
+};
+
+struct provenance_log{
+  int fd;
+  uint64_t end;
+  uint8_t* block;           // records of the current block
+  size_t block_size;
+  size_t used;
+  struct log_block_header current;  // count is 0 when the block is empty
+  struct compress_stream stream;
+  struct log_index_entry* index;
+  size_t index_count;
+  size_t index_size;
+  struct log_stats stats;
+  pthread_mutex_t lock;
+};
+
+struct log_reader{
+  const uint8_t* map;
+  size_t size;
+  struct log_index_entry* index;
+  size_t index_count;
+};
+
+static inline void __header_encode(const struct log_block_header* h, struct log_block_header* out){
+  out->magic = htole32(h->magic);
+  out->count = htole32(h->count);
+  out->length = htole32(h->length);
+  out->crc = htole32(h->crc);
+  out->jiffies_min = htole64(h->jiffies_min);
+  out->jiffies_max = htole64(h->jiffies_max);
+  out->node_types = htole64(h->node_types);
+  out->relation_types = htole64(h->relation_types);
+  out->machine_id = htole32(h->machine_id);
+  out->pad = 0;
+}
+
+/* buf may be unaligned */
+static inline void __header_decode(const uint8_t* buf, struct log_block_header* h){
+  memcpy(h, buf, sizeof(struct log_block_header));
+  h->magic = le32toh(h->magic);
+  h->count = le32toh(h->count);
+  h->length = le32toh(h->length);
+  h->crc = le32toh(h->crc);
+  h->jiffies_min = le64toh(h->jiffies_min);
+  h->jiffies_max = le64toh(h->jiffies_max);
+  h->node_types = le64toh(h->node_types);
+  h->relation_types = le64toh(h->relation_types);
+  h->machine_id = le32toh(h->machine_id);
+}
+
+/* check a block header read at offset in a file of size bytes */
+static inline bool __header_valid(const struct log_block_header* h, uint64_t offset, uint64_t size){
+  return h->magic == LOG_BLOCK_MAGIC
+    && offset + sizeof(struct log_block_header) + h->length <= size;
+}
+
+static inline uint32_t __crc(const void* buf, size_t length){
+  return crc32(0L, (const Bytef*)buf, length);
+}
+
+static int __file_header_check(const struct log_file_header* fh){
+  if(memcmp(fh->magic, LOG_MAGIC, LOG_MAGIC_LENGTH) != 0)
+    return -EINVAL;
+  if(fh->byte_order != LOG_BYTE_ORDER
+    || le32toh(fh->elt_size) != sizeof(union prov_elt)
+    || le32toh(fh->long_elt_size) != sizeof(union long_prov_elt))
+    return -EPROTO; // written by another kernel version or architecture
+  return 0;
+}
+
+/* return the number of indexed blocks, or -1 if there is no usable footer */
+static int64_t __footer_check(const struct log_footer* footer, uint64_t size){
+  uint64_t offset = le64toh(footer->index_offset);
+  uint64_t blocks = le32toh(footer->blocks);
+
+  if(memcmp(footer->magic, LOG_INDEX_MAGIC, LOG_MAGIC_LENGTH) != 0)
+    return -1;
+  if(offset < sizeof(struct log_file_header)
+    || offset + blocks*sizeof(struct log_index_entry) + sizeof(struct log_footer) != size)
+    return -1;
+  return blocks;
+}
+
+/* buf holds count on-disk entries, return 0 or -1 if they do not check out */
+static int __index_decode(const uint8_t* buf, size_t count, uint64_t index_offset, struct log_index_entry* index){
+  size_t i;
+
+  for(i = 0; i < count; i++){
+    memcpy(&index[i].offset, buf + i*sizeof(struct log_index_entry), sizeof(uint64_t));
+    index[i].offset = le64toh(index[i].offset);
+    __header_decode(buf + i*sizeof(struct log_index_entry) + sizeof(uint64_t), &index[i].header);
+    if(!__header_valid(&index[i].header, index[i].offset, index_offset))
+      return -1;
+  }
+  return 0;
+}
+
+static int __index_append(struct log_index_entry** index, size_t* count, size_t* size, uint64_t offset, const struct log_block_header* h){
+  struct log_index_entry* tmp;
+
+  if(*count == *size){
+    tmp = (struct log_index_entry*)realloc(*index, (*size ? *size*2 : LOG_INDEX_INITIAL)*sizeof(struct log_index_entry));
+    if(tmp == NULL)
+      return -ENOMEM;
+    *index = tmp;
+    *size = *size ? *size*2 : LOG_INDEX_INITIAL;
+  }
+  (*index)[*count].offset = offset;
+  memcpy(&(*index)[*count].header, h, sizeof(struct log_block_header));
+  (*count)++;
+  return 0;
+}
+
+static inline int __pread_all(int fd, void* buf, size_t length, uint64_t offset){
+  uint8_t* p = (uint8_t*)buf;
+  ssize_t rc;
+
+  while(length > 0){
+    rc = pread(fd, p, length, offset);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    if(rc == 0)
+      return -EIO;
+    p += rc;
+    offset += rc;
+    length -= rc;
+  }
+  return 0;
+}
+
+static inline int __pwrite_all(int fd, const void* buf, size_t length, uint64_t offset){
+  const uint8_t* p = (const uint8_t*)buf;
+  ssize_t rc;
+
+  while(length > 0){
+    rc = pwrite(fd, p, length, offset);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    p += rc;
+    offset += rc;
+    length -= rc;
+  }
+  return 0;
+}
+
+/* header and frame in one call, a short write leaves a block __log_load drops */
+static inline int __pwrite_block(int fd, struct log_block_header* h, const uint8_t* frame, size_t length, uint64_t offset){
+  struct iovec iov[2];
+  ssize_t rc;
+
+  iov[0].iov_base = h;
+  iov[0].iov_len = sizeof(struct log_block_header);
+  iov[1].iov_base = (void*)frame;
+  iov[1].iov_len = length;
+  do{
+    rc = pwritev(fd, iov, 2, offset);
+  }while(rc < 0 && errno == EINTR);
+  if(rc < 0)
+    return -errno;
+  if((size_t)rc < sizeof(struct log_block_header)){ // short write, finish piecewise
+    rc = __pwrite_all(fd, (uint8_t*)h + rc, sizeof(struct log_block_header) - rc, offset + rc);
+    if(rc < 0)
+      return rc;
+    rc = sizeof(struct log_block_header);
+  }
+  rc -= sizeof(struct log_block_header);
+  return __pwrite_all(fd, frame + rc, length - rc, offset + sizeof(struct log_block_header) + rc);
+}
+
+static int __log_create(struct provenance_log* log){
+  struct log_file_header fh;
+  int rc;
+
+  memset(&fh, 0, sizeof(struct log_file_header));
+  memcpy(fh.magic, LOG_MAGIC, LOG_MAGIC_LENGTH);
+  fh.elt_size = htole32(sizeof(union prov_elt));
+  fh.long_elt_size = htole32(sizeof(union long_prov_elt));
+  fh.byte_order = LOG_BYTE_ORDER;
+  rc = __pwrite_all(log->fd, &fh, sizeof(struct log_file_header), 0);
+  if(rc < 0)
+    return rc;
+  log->end = sizeof(struct log_file_header);
+  return 0;
+}
+
+/* reload the index from the footer, or walk the blocks when there is none */
+static int __log_load(struct provenance_log* log, uint64_t size){
+  struct log_file_header fh;
+  struct log_footer footer;
+  struct log_block_header h;
+  uint8_t raw[sizeof(struct log_block_header)];
+  uint64_t offset = sizeof(struct log_file_header);
+  uint8_t* buf = NULL;
+  size_t buf_size = 0;
+  uint8_t* tmp;
+  int64_t blocks = -1;
+  int rc;
+
+  rc = __pread_all(log->fd, &fh, sizeof(struct log_file_header), 0);
+  if(rc < 0)
+    return rc;
+  rc = __file_header_check(&fh);
+  if(rc < 0)
+    return rc;
+  if(size >= sizeof(struct log_file_header) + sizeof(struct log_footer)){
+    rc = __pread_all(log->fd, &footer, sizeof(struct log_footer), size - sizeof(struct log_footer));
+    if(rc < 0)
+      return rc;
+    blocks = __footer_check(&footer, size);
+  }
+  if(blocks >= 0){
+    offset = le64toh(footer.index_offset);
+    buf_size = blocks*sizeof(struct log_index_entry);
+    buf = (uint8_t*)malloc(buf_size + 1);
+    log->index = (struct log_index_entry*)malloc((blocks + 1)*sizeof(struct log_index_entry));
+    if(buf == NULL || log->index == NULL){
+      rc = -ENOMEM;
+      goto out;
+    }
+    log->index_size = blocks + 1;
+    rc = __pread_all(log->fd, buf, buf_size, offset);
+    if(rc < 0)
+      goto out;
+    if(__crc(buf, buf_size) == le32toh(footer.crc)
+      && __index_decode(buf, blocks, offset, log->index) == 0){
+      log->index_count = blocks;
+      goto truncate;
+    }
+    offset = sizeof(struct log_file_header); // damaged index, walk the blocks
+  }
+
+  // every payload is checked, a crash may leave a torn block at the end
+  while(offset + sizeof(struct log_block_header) <= size){
+    rc = __pread_all(log->fd, raw, sizeof(struct log_block_header), offset);
+    if(rc < 0)
+      goto out;
+    __header_decode(raw, &h);
+    if(!__header_valid(&h, offset, size))
+      break;
+    if(h.length > buf_size){
+      tmp = (uint8_t*)realloc(buf, h.length);
+      if(tmp == NULL){
+        rc = -ENOMEM;
+        goto out;
+      }
+      buf = tmp;
+      buf_size = h.length;
+    }
+    rc = __pread_all(log->fd, buf, h.length, offset + sizeof(struct log_block_header));
+    if(rc < 0)
+      goto out;
+    if(__crc(buf, h.length) != h.crc)
+      break;
+    rc = __index_append(&log->index, &log->index_count, &log->index_size, offset, &h);
+    if(rc < 0)
+      goto out;
+    offset += sizeof(struct log_block_header) + h.length;
+  }
+
+truncate:
+  if(offset < size && ftruncate(log->fd, offset) < 0){
+    rc = -errno;
+    goto out;
+  }
+  log->end = offset;
+  rc = 0;
+out:
+  free(buf);
+  return rc;
+}
+
+struct provenance_log* provenance_log_open(const char* path, size_t block_size, int level){
+  struct provenance_log* log;
+  struct stat st;
+  int rc;
+
+  log = (struct provenance_log*)calloc(1, sizeof(struct provenance_log));
+  if(log == NULL)
+    return NULL;
+  if(block_size == 0)
+    block_size = LOG_DEFAULT_BLOCK;
+  if(block_size < LOG_RECORD_HEADER + sizeof(union long_prov_elt))
+    block_size = LOG_RECORD_HEADER + sizeof(union long_prov_elt);
+  if(block_size > UINT32_MAX) // frames record their length on 32 bits
+    block_size = UINT32_MAX;
+  log->block_size = block_size;
+  log->block = (uint8_t*)malloc(block_size);
+  if(log->block == NULL){
+    rc = -ENOMEM;
+    goto error;
+  }
+  rc = compress_stream_init(&log->stream, level);
+  if(rc < 0)
+    goto error;
+  log->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+  if(log->fd < 0){
+    rc = -errno;
+    goto error_stream;
+  }
+  if(fstat(log->fd, &st) < 0)
+    rc = -errno;
+  else if(st.st_size < (off_t)sizeof(struct log_file_header))
+    rc = __log_create(log);
+  else
+    rc = __log_load(log, st.st_size);
+  if(rc < 0){
+    close(log->fd);
+    goto error_stream;
+  }
+  log->stats.blocks = log->index_count;
+  pthread_mutex_init(&log->lock, NULL);
+  return log;
+
+error_stream:
+  compress_stream_end(&log->stream);
+error:
+  free(log->index);
+  free(log->block);
+  free(log);
+  errno = -rc;
+  return NULL;
+}
+
+/* called with the lock held */
+static int __block_write(struct provenance_log* log){
+  struct log_block_header h;
+  uint8_t* frame;
+  size_t framelen;
+  int rc;
+
+  if(log->current.count == 0)
+    return 0;
+  rc = compress_stream_frame(&log->stream, log->block, log->used, &frame, &framelen);
+  if(rc < 0)
+    return rc;
+  log->current.magic = LOG_BLOCK_MAGIC;
+  log->current.length = framelen;
+  log->current.crc = __crc(frame, framelen);
+  // room in the index first, a block on disk is always indexed on close
+  rc = __index_append(&log->index, &log->index_count, &log->index_size, log->end, &log->current);
+  if(rc < 0)
+    return rc;
+  __header_encode(&log->current, &h);
+  rc = __pwrite_block(log->fd, &h, frame, framelen, log->end);
+  if(rc < 0){
+    log->index_count--;
+    return rc;
+  }
+  log->end += sizeof(struct log_block_header) + framelen;
+  log->stats.blocks++;
+  log->stats.bytes += sizeof(struct log_block_header) + framelen;
+  memset(&log->current, 0, sizeof(struct log_block_header));
+  log->used = 0;
+  return 0;
+}
+
+static int __log_append(struct provenance_log* log, const void* msg, size_t length, uint64_t type, uint64_t jiffies, uint32_t machine_id){
+  uint32_t header[2] = {htole32(length), 0};
+  int rc = 0;
+
+  pthread_mutex_lock(&log->lock);
+  if(log->current.count > 0
+    && ((machine_id != 0 && log->current.machine_id != 0 && log->current.machine_id != machine_id)
+      || log->used + LOG_RECORD_HEADER + length > log->block_size)){
+    rc = __block_write(log);
+    if(rc < 0)
+      goto out;
+  }
+  memcpy(log->block + log->used, header, LOG_RECORD_HEADER);
+  memcpy(log->block + log->used + LOG_RECORD_HEADER, msg, length);
+  log->used += LOG_RECORD_HEADER + length;
+  if(log->current.count == 0 || jiffies < log->current.jiffies_min)
+    log->current.jiffies_min = jiffies;
+  if(log->current.count == 0 || jiffies > log->current.jiffies_max)
+    log->current.jiffies_max = jiffies;
+  if((type & DM_RELATION) != 0)
+    log->current.relation_types |= type & SUBTYPE_MASK;
+  else
+    log->current.node_types |= type & SUBTYPE_MASK;
+  if(machine_id != 0)
+    log->current.machine_id = machine_id;
+  log->current.count++;
+  log->stats.records++;
+  log->stats.raw_bytes += LOG_RECORD_HEADER + length;
+out:
+  pthread_mutex_unlock(&log->lock);
+  return rc;
+}
+
+/* packets carry no machine_id, they go with the block they land in */
+int provenance_log_record(struct provenance_log* log, const union prov_elt* msg){
+  uint32_t machine_id = (prov_type(msg) == ENT_PACKET) ? 0 : node_identifier(msg).machine_id;
+
+  return __log_append(log, msg, sizeof(union prov_elt), prov_type(msg), prov_jiffies(msg), machine_id);
+}
+
+int provenance_log_long_record(struct provenance_log* log, const union long_prov_elt* msg){
+  return __log_append(log, msg, sizeof(union long_prov_elt), prov_type(msg), prov_jiffies(msg), node_identifier(msg).machine_id);
+}
+
+int provenance_log_flush(struct provenance_log* log){
+  int rc;
+
+  pthread_mutex_lock(&log->lock);
+  rc = __block_write(log);
+  pthread_mutex_unlock(&log->lock);
+  return rc;
+}
+
+void provenance_log_stats(struct provenance_log* log, struct log_stats* stats){
+  pthread_mutex_lock(&log->lock);
+  memcpy(stats, &log->stats, sizeof(struct log_stats));
+  pthread_mutex_unlock(&log->lock);
+}
+
+/* on failure the log is left without index, readers walk the blocks */
+static int __index_write(struct provenance_log* log){
+  struct log_footer footer;
+  uint8_t* buf;
+  size_t length = log->index_count*sizeof(struct log_index_entry);
+  size_t i;
+  uint64_t offset;
+  int rc;
+
+  buf = (uint8_t*)malloc(length + 1);
+  if(buf == NULL)
+    return -ENOMEM;
+  for(i = 0; i < log->index_count; i++){
+    offset = htole64(log->index[i].offset);
+    memcpy(buf + i*sizeof(struct log_index_entry), &offset, sizeof(uint64_t));
+    __header_encode(&log->index[i].header, (struct log_block_header*)(buf + i*sizeof(struct log_index_entry) + sizeof(uint64_t)));
+  }
+  footer.index_offset = htole64(log->end);
+  footer.blocks = htole32(log->index_count);
+  footer.crc = htole32(__crc(buf, length));
+  memcpy(footer.magic, LOG_INDEX_MAGIC, LOG_MAGIC_LENGTH);
+  rc = __pwrite_all(log->fd, buf, length, log->end);
+  if(rc == 0)
+    rc = __pwrite_all(log->fd, &footer, sizeof(struct log_footer), log->end + length);
+  free(buf);
+  return rc;
+}
+
+void provenance_log_close(struct provenance_log* log){
+  pthread_mutex_lock(&log->lock);
+  if(__block_write(log) == 0)
+    __index_write(log);
+  pthread_mutex_unlock(&log->lock);
+  fdatasync(log->fd);
+  close(log->fd);
+  pthread_mutex_destroy(&log->lock);
+  compress_stream_end(&log->stream);
+  free(log->index);
+  free(log->block);
+  free(log);
+}
+
+/* walk the block headers of a log that was not closed, it may be being written */
+static int __reader_walk(struct log_reader* reader){
+  struct log_block_header h;
+  uint64_t offset = sizeof(struct log_file_header);
+  size_t index_size = 0;
+  int rc;
+
+  while(offset + sizeof(struct log_block_header) <= reader->size){
+    __header_decode(reader->map + offset, &h);
+    if(!__header_valid(&h, offset, reader->size))
+      break;
+    rc = __index_append(&reader->index, &reader->index_count, &index_size, offset, &h);
+    if(rc < 0)
+      return rc;
+    offset += sizeof(struct log_block_header) + h.length;
+  }
+  // only the last block can be torn
+  if(reader->index_count > 0){
+    offset = reader->index[reader->index_count-1].offset + sizeof(struct log_block_header);
+    if(__crc(reader->map + offset, reader->index[reader->index_count-1].header.length) != reader->index[reader->index_count-1].header.crc)
+      reader->index_count--;
+  }
+  return 0;
+}
+
+struct log_reader* provenance_log_reader_open(const char* path){
+  struct log_reader* reader;
+  struct log_footer footer;
+  struct stat st;
+  uint64_t offset;
+  int64_t blocks = -1;
+  void* map;
+  int fd;
+  int rc;
+
+  reader = (struct log_reader*)calloc(1, sizeof(struct log_reader));
+  if(reader == NULL)
+    return NULL;
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    rc = -errno;
+    goto error;
+  }
+  if(fstat(fd, &st) < 0){
+    rc = -errno;
+    close(fd);
+    goto error;
+  }
+  if(st.st_size < (off_t)sizeof(struct log_file_header)){
+    rc = -EINVAL;
+    close(fd);
+    goto error;
+  }
+  // blocks are only faulted in when a scan reads them
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED){
+    rc = -errno;
+    close(fd);
+    goto error;
+  }
+  close(fd);
+  reader->map = (const uint8_t*)map;
+  reader->size = st.st_size;
+  rc = __file_header_check((const struct log_file_header*)reader->map);
+  if(rc < 0)
+    goto error_map;
+
+  if(reader->size >= sizeof(struct log_file_header) + sizeof(struct log_footer)){
+    memcpy(&footer, reader->map + reader->size - sizeof(struct log_footer), sizeof(struct log_footer));
+    blocks = __footer_check(&footer, reader->size);
+  }
+  if(blocks >= 0){
+    offset = le64toh(footer.index_offset);
+    reader->index = (struct log_index_entry*)malloc((blocks + 1)*sizeof(struct log_index_entry));
+    if(reader->index == NULL){
+      rc = -ENOMEM;
+      goto error_map;
+    }
+    if(__crc(reader->map + offset, blocks*sizeof(struct log_index_entry)) == le32toh(footer.crc)
+      && __index_decode(reader->map + offset, blocks, offset, reader->index) == 0){
+      reader->index_count = blocks;
+      return reader;
+    }
+    free(reader->index);
+    reader->index = NULL;
+  }
+  rc = __reader_walk(reader);
+  if(rc < 0)
+    goto error_map;
+  return reader;
+
+error_map:
+  munmap((void*)reader->map, reader->size);
+error:
+  free(reader->index);
+  free(reader);
+  errno = -rc;
+  return NULL;
+}
+
+void provenance_log_reader_close(struct log_reader* reader){
+  munmap((void*)reader->map, reader->size);
+  free(reader->index);
+  free(reader);
+}
+
+static inline bool __types_match(uint64_t nodes, uint64_t relations, const struct log_query* query){
+  if(query->node_types == 0 && query->relation_types == 0)
+    return true;
+  return (nodes & query->node_types) != 0 || (relations & query->relation_types) != 0;
+}
+
+static inline bool __block_match(const struct log_block_header* h, const struct log_query* query){
+  if(query->since != 0 && h->jiffies_max < query->since)
+    return false;
+  if(query->until != 0 && h->jiffies_min > query->until)
+    return false;
+  if(query->machine_id != 0 && h->machine_id != query->machine_id)
+    return false;
+  return __types_match(h->node_types, h->relation_types, query);
+}
+
+static inline bool __record_match(const union prov_elt* msg, uint32_t machine_id, const struct log_query* query){
+  uint64_t type = prov_type(msg);
+
+  if(query->since != 0 && prov_jiffies(msg) < query->since)
+    return false;
+  if(query->until != 0 && prov_jiffies(msg) > query->until)
+    return false;
+  if(query->machine_id != 0 && machine_id != query->machine_id)
+    return false;
+  if((type & DM_RELATION) != 0)
+    return __types_match(0, type & SUBTYPE_MASK, query);
+  return __types_match(type & SUBTYPE_MASK, 0, query);
+}
+
+/* records of a block all share its machine_id */
+static int __block_scan(const char* raw, size_t length, uint32_t machine_id, const struct log_query* query, struct log_scan_stats* stats){
+  const union prov_elt* msg;
+  uint32_t header[2];
+  size_t offset = 0;
+
+  while(offset + LOG_RECORD_HEADER <= length){
+    memcpy(header, raw + offset, LOG_RECORD_HEADER);
+    header[0] = le32toh(header[0]);
+    offset += LOG_RECORD_HEADER;
+    if(offset + header[0] > length
+      || (header[0] != sizeof(union prov_elt) && header[0] != sizeof(union long_prov_elt)))
+      return -EBADMSG;
+    msg = (const union prov_elt*)(raw + offset); // common prefix of both unions
+    stats->records++;
+    if(__record_match(msg, machine_id, query)){
+      stats->matched++;
+      if(header[0] == sizeof(union prov_elt) && query->record != NULL)
+        query->record(msg, query->data);
+      else if(header[0] == sizeof(union long_prov_elt) && query->long_record != NULL)
+        query->long_record((const union long_prov_elt*)(raw + offset), query->data);
+    }
+    offset += header[0];
+  }
+  return 0;
+}
+
+int provenance_log_scan(struct log_reader* reader, const struct log_query* query, struct log_scan_stats* stats){
+  struct log_scan_stats s;
+  const struct log_block_header* h;
+  const uint8_t* frame;
+  char* raw;
+  size_t length;
+  size_t i;
+  int rc = 0;
+
+  memset(&s, 0, sizeof(struct log_scan_stats));
+  for(i = 0; i < reader->index_count; i++){
+    h = &reader->index[i].header;
+    s.blocks++;
+    if(!__block_match(h, query))
+      continue;
+    s.blocks_read++;
+    frame = reader->map + reader->index[i].offset + sizeof(struct log_block_header);
+    if(__crc(frame, h->length) != h->crc){
+      rc = -EBADMSG;
+      break;
+    }
+    if(decompress_frame(frame, h->length, &raw, &length) < 0){
+      rc = -EBADMSG;
+      break;
+    }
+    rc = __block_scan(raw, length, h->machine_id, query, &s);
+    free(raw);
+    if(rc < 0)
+      break;
+  }
+  if(stats != NULL)
+    memcpy(stats, &s, sizeof(struct log_scan_stats));
+  return rc;
+}
@@ -0,0 +1,217 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/provenance_types.h>
+
+#include "provenanceutils.h"
+
+/*
+* Path names reach us as ENT_FILE_NAME records (long relay) and are attached
+* to inodes by RL_NAMED relations (relay), in no particular order. Two
+* direct-mapped tables are kept: inode -> name node, and name node -> path.
+* Keys ignore the version, any version of an inode resolves to its last
+* known name. Path strings are charged against a byte budget, a clock hand
+* evicts names when it is exhausted.
+*/
+#define PATH_CACHE_MIN    (64*1024)
+#define PATH_AVG_LENGTH   64 // used to size the tables
+
+struct path_key {
+  uint64_t id;
+  uint32_t boot_id;
+};
+
+struct inode_entry {
+  bool used;
+  struct path_key key;
+  struct path_key name;
+};
+
+struct name_entry {
+  bool used;
+  struct path_key key;
+  uint32_t length;
+  char* path;
+};
+
+static struct inode_entry* inodes = NULL;
+static struct name_entry* names = NULL;
+static uint32_t slots;    // power of 2, same for both tables
+static size_t path_budget;
+static size_t path_bytes;
+static uint32_t clock_hand;
+static pthread_rwlock_t l_path = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline void __to_key(const union prov_identifier* id, struct path_key* key){
+  memset(key, 0, sizeof(struct path_key));
+  key->id = id->node_id.id;
+  key->boot_id = id->node_id.boot_id;
+}
+
+static inline uint32_t __path_slot(const struct path_key* key){
+  uint64_t h = (key->id ^ ((uint64_t)key->boot_id << 32)) * 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(h >> 32) & (slots-1);
+}
+
+static inline bool __key_equal(const struct path_key* a, const struct path_key* b){
+  return a->id == b->id && a->boot_id == b->boot_id;
+}
+
+static inline void __evict_name(struct name_entry* e){
+  path_bytes -= e->length + 1;
+  free(e->path);
+  e->path = NULL;
+  e->used = false;
+}
+
+int provenance_path_cache_start(size_t memory){
+  size_t entry = sizeof(struct inode_entry) + sizeof(struct name_entry);
+
+  if(memory < PATH_CACHE_MIN)
+    return -EINVAL;
+  pthread_rwlock_wrlock(&l_path);
+  if(inodes != NULL){
+    pthread_rwlock_unlock(&l_path);
+    return -EBUSY;
+  }
+  for(slots = 1; (size_t)slots*4*(entry + PATH_AVG_LENGTH) <= memory; slots *= 2);
+  inodes = calloc(slots, sizeof(struct inode_entry));
+  names = calloc(slots, sizeof(struct name_entry));
+  if(inodes == NULL || names == NULL){
+    free(inodes);
+    free(names);
+    inodes = NULL;
+    names = NULL;
+    pthread_rwlock_unlock(&l_path);
+    return -ENOMEM;
+  }
+  path_budget = memory - slots*entry;
+  path_bytes = 0;
+  clock_hand = 0;
+  pthread_rwlock_unlock(&l_path);
+  return 0;
+}
+
+void provenance_path_cache_stop(void){
+  uint32_t i;
+
+  pthread_rwlock_wrlock(&l_path);
+  if(names != NULL){
+    for(i = 0; i < slots; i++)
+      free(names[i].path);
+  }
+  free(inodes);
+  free(names);
+  inodes = NULL;
+  names = NULL;
+  pthread_rwlock_unlock(&l_path);
+}
+
+void provenance_path_cache_name(const struct file_name_struct* name){
+  struct path_key key;
+  struct name_entry* e;
+  size_t length;
+  char* path;
+
+  if(inodes == NULL) // unlocked check, the cache is set up at startup
+    return;
+  length = strnlen(name->name, sizeof(name->name));
+  if(name->length < length)
+    length = name->length;
+  if(length == 0)
+    return;
+  path = malloc(length + 1);
+  if(path == NULL)
+    return;
+  memcpy(path, name->name, length);
+  path[length] = '\0';
+  __to_key(&name->identifier, &key);
+  pthread_rwlock_wrlock(&l_path);
+  if(names == NULL){
+    pthread_rwlock_unlock(&l_path);
+    free(path);
+    return;
+  }
+  e = &names[__path_slot(&key)];
+  if(e->used)
+    __evict_name(e);
+  while(path_bytes + length + 1 > path_budget){
+    if(names[clock_hand].used)
+      __evict_name(&names[clock_hand]);
+    clock_hand = (clock_hand + 1) & (slots-1);
+  }
+  memcpy(&e->key, &key, sizeof(struct path_key));
+  e->path = path;
+  e->length = length;
+  e->used = true;
+  path_bytes += length + 1;
+  pthread_rwlock_unlock(&l_path);
+}
+
+void provenance_path_cache_named(const struct relation_struct* relation){
+  const union prov_identifier* inode;
+  const union prov_identifier* name;
+  struct path_key key;
+  struct inode_entry* e;
+
+  if(inodes == NULL || relation->identifier.relation_id.type != RL_NAMED)
+    return;
+  if(relation->snd.node_id.type == ENT_FILE_NAME){
+    name = &relation->snd;
+    inode = &relation->rcv;
+  }else if(relation->rcv.node_id.type == ENT_FILE_NAME){
+    name = &relation->rcv;
+    inode = &relation->snd;
+  }else
+    return;
+  __to_key(inode, &key);
+  pthread_rwlock_wrlock(&l_path);
+  if(inodes == NULL){
+    pthread_rwlock_unlock(&l_path);
+    return;
+  }
+  e = &inodes[__path_slot(&key)];
+  memcpy(&e->key, &key, sizeof(struct path_key));
+  __to_key(name, &e->name);
+  e->used = true;
+  pthread_rwlock_unlock(&l_path);
+}
+
+int provenance_path_cache_lookup(const union prov_identifier* inode, char* path, size_t pathlen){
+  struct path_key key;
+  struct inode_entry* i;
+  struct name_entry* n;
+  int rc = -ENOENT;
+
+  if(inodes == NULL || pathlen == 0)
+    return -ENOENT;
+  __to_key(inode, &key);
+  pthread_rwlock_rdlock(&l_path);
+  if(inodes == NULL)
+    goto out;
+  i = &inodes[__path_slot(&key)];
+  if(!i->used || !__key_equal(&i->key, &key))
+    goto out;
+  n = &names[__path_slot(&i->name)];
+  if(!n->used || !__key_equal(&n->key, &i->name))
+    goto out; // name not seen yet or evicted
+  strncpy(path, n->path, pathlen);
+  path[pathlen-1] = '\0';
+  rc = 0;
+out:
+  pthread_rwlock_unlock(&l_path);
+  return rc;
+}
@@ -0,0 +1,570 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <linux/provenance_types.h>
+
+#include "provenance.h"
+#include "provenancefilter.h"
+#include "provenancepolicy.h"
+
+/*
+* Rule lists (ipv4, secctx, uid, gid, cgroup) are kept as arrays of the
+* structure the kernel reads and writes, sorted on their key. The current
+* state is read back into the same form and both arrays are merged to find
+* what differs. Type filters are bitmasks and are diffed bitwise.
+*
+* There is no transaction in the kernel: changes are made one write at a
+* time, rules added or changed first and rules removed last, and every write
+* is reverted in reverse order if one fails.
+*/
+#define POLICY_MAX_READ   (1 << 16) // rules read back per list
+
+#define OP_TRACK      0x01
+#define OP_PROPAGATE  0x02
+#define OP_RECORD     0x04
+#define OP_OPAQUE     0x08
+
+static const struct{
+  const char* key;
+  uint8_t flag;
+  uint8_t op;
+} policy_ops[] = {
+  {"track", OP_TRACK, PROV_SET_TRACKED},
+  {"propagate", OP_PROPAGATE, PROV_SET_TRACKED|PROV_SET_PROPAGATE},
+  {"record", OP_RECORD, PROV_SET_TRACKED|PROV_SET_RECORD},
+  {"opaque", OP_OPAQUE, PROV_SET_OPAQUE},
+};
+
+struct rule_kind{
+  const char* section;
+  const char* file;
+  size_t size;          // kernel structure
+  size_t op;            // offset of its op field
+  uint8_t allowed;      // OP_* accepted in the document
+  int (*parse)(const char* value, void* elt);
+  int (*compare)(const void* a, const void* b);
+};
+
+static int __parse_ipv4(const char* value, void* elt){
+  return provenance_ipv4_filter_parse(value, (struct prov_ipv4_filter*)elt);
+}
+
+static int __compare_ipv4(const void* a, const void* b){
+  const struct prov_ipv4_filter* x = a;
+  const struct prov_ipv4_filter* y = b;
+
+  if(x->ip != y->ip)
+    return (x->ip < y->ip) ? -1 : 1;
+  if(x->mask != y->mask)
+    return (x->mask < y->mask) ? -1 : 1;
+  if(x->port != y->port)
+    return (x->port < y->port) ? -1 : 1;
+  return 0;
+}
+
+static int __parse_secctx(const char* value, void* elt){
+  struct secinfo* s = elt;
+  size_t len = strlen(value);
+
+  if(len == 0 || len >= PATH_MAX)
+    return -EINVAL;
+  memcpy(s->secctx, value, len + 1);
+  s->len = len;
+  return 0;
+}
+
+static int __compare_secctx(const void* a, const void* b){
+  return strncmp(((const struct secinfo*)a)->secctx, ((const struct secinfo*)b)->secctx, PATH_MAX);
+}
+
+static inline int __parse_id(const char* value, uint32_t* id){
+  char* end;
+  unsigned long v;
+
+  errno = 0;
+  v = strtoul(value, &end, 10);
+  if(*value == '\0' || *end != '\0' || errno != 0 || v > UINT32_MAX)
+    return -EINVAL;
+  *id = v;
+  return 0;
+}
+
+static int __parse_uid(const char* value, void* elt){
+  struct passwd* pwd = getpwnam(value);
+
+  if(pwd == NULL)
+    return __parse_id(value, &((struct userinfo*)elt)->uid);
+  ((struct userinfo*)elt)->uid = pwd->pw_uid;
+  return 0;
+}
+
+static int __compare_uid(const void* a, const void* b){
+  const struct userinfo* x = a;
+  const struct userinfo* y = b;
+
+  return (x->uid > y->uid) - (x->uid < y->uid);
+}
+
+static int __parse_gid(const char* value, void* elt){
+  struct group* gr = getgrnam(value);
+
+  if(gr == NULL)
+    return __parse_id(value, &((struct groupinfo*)elt)->gid);
+  ((struct groupinfo*)elt)->gid = gr->gr_gid;
+  return 0;
+}
+
+static int __compare_gid(const void* a, const void* b){
+  const struct groupinfo* x = a;
+  const struct groupinfo* y = b;
+
+  return (x->gid > y->gid) - (x->gid < y->gid);
+}
+
+static int __parse_cgroup(const char* value, void* elt){
+  return __parse_id(value, &((struct nsinfo*)elt)->cgroupns);
+}
+
+static int __compare_ns(const void* a, const void* b){
+  const struct nsinfo* x = a;
+  const struct nsinfo* y = b;
+
+  if(x->cgroupns != y->cgroupns)
+    return (x->cgroupns < y->cgroupns) ? -1 : 1;
+  if(x->ipcns != y->ipcns)
+    return (x->ipcns < y->ipcns) ? -1 : 1;
+  if(x->mntns != y->mntns)
+    return (x->mntns < y->mntns) ? -1 : 1;
+  if(x->pidns != y->pidns)
+    return (x->pidns < y->pidns) ? -1 : 1;
+  if(x->netns != y->netns)
+    return (x->netns < y->netns) ? -1 : 1;
+  return 0;
+}
+
+#define RULE_KINDS 6
+
+static const struct rule_kind rule_kinds[RULE_KINDS] = {
+  {"ipv4-ingress", PROV_IPV4_INGRESS_FILE, sizeof(struct prov_ipv4_filter), offsetof(struct prov_ipv4_filter, op),
+    OP_TRACK|OP_PROPAGATE|OP_RECORD, __parse_ipv4, __compare_ipv4},
+  {"ipv4-egress", PROV_IPV4_EGRESS_FILE, sizeof(struct prov_ipv4_filter), offsetof(struct prov_ipv4_filter, op),
+    OP_TRACK|OP_PROPAGATE|OP_RECORD, __parse_ipv4, __compare_ipv4},
+  {"secctx", PROV_SECCTX_FILTER, sizeof(struct secinfo), offsetof(struct secinfo, op),
+    OP_TRACK|OP_PROPAGATE|OP_OPAQUE, __parse_secctx, __compare_secctx},
+  {"user", PROV_UID_FILTER, sizeof(struct userinfo), offsetof(struct userinfo, op),
+    OP_TRACK|OP_PROPAGATE|OP_OPAQUE, __parse_uid, __compare_uid},
+  {"group", PROV_GID_FILTER, sizeof(struct groupinfo), offsetof(struct groupinfo, op),
+    OP_TRACK|OP_PROPAGATE|OP_OPAQUE, __parse_gid, __compare_gid},
+  {"cgroup", PROV_NS_FILTER, sizeof(struct nsinfo), offsetof(struct nsinfo, op),
+    OP_TRACK|OP_PROPAGATE, __parse_cgroup, __compare_ns},
+};
+
+struct mask_kind{
+  const char* key;
+  bool relation;
+  int (*get)(uint64_t* filter);
+  int (*add)(uint64_t filter);
+  int (*remove)(uint64_t filter);
+};
+
+#define MASK_KINDS 4
+
+static const struct mask_kind mask_kinds[MASK_KINDS] = {
+  {"node_filter", false, provenance_get_node_filter, provenance_add_node_filter, provenance_remove_node_filter},
+  {"relation_filter", true, provenance_get_relation_filter, provenance_add_relation_filter, provenance_remove_relation_filter},
+  {"propagate_node_filter", false, provenance_get_propagate_node_filter, provenance_add_propagate_node_filter, provenance_remove_propagate_node_filter},
+  {"propagate_relation_filter", true, provenance_get_propagate_relation_filter, provenance_add_propagate_relation_filter, provenance_remove_propagate_relation_filter},
+};
+
+struct rule_set{
+  uint8_t* elts;
+  size_t count;
+  size_t size;
+};
+
+struct capture_policy{
+  struct rule_set rules[RULE_KINDS];
+  uint64_t masks[MASK_KINDS];
+};
+
+static inline uint8_t* __rule(const struct rule_kind* k, const struct rule_set* set, size_t i){
+  return set->elts + i*k->size;
+}
+
+static inline uint8_t* __rule_op(const struct rule_kind* k, uint8_t* elt){
+  return elt + k->op;
+}
+
+static uint8_t* __rule_add(const struct rule_kind* k, struct rule_set* set){
+  uint8_t* tmp;
+
+  if(set->count == set->size){
+    set->size = (set->size == 0) ? 16 : set->size*2;
+    tmp = realloc(set->elts, set->size*k->size);
+    if(tmp == NULL)
+      return NULL;
+    set->elts = tmp;
+  }
+  tmp = __rule(k, set, set->count++);
+  memset(tmp, 0, k->size);
+  return tmp;
+}
+
+/* sort on the key and merge duplicates, a key listed twice gets both operations */
+static void __rule_normalise(const struct rule_kind* k, struct rule_set* set){
+  size_t i;
+  size_t n = 0;
+
+  if(set->count == 0)
+    return;
+  qsort(set->elts, set->count, k->size, k->compare);
+  for(i = 1; i < set->count; i++){
+    if(k->compare(__rule(k, set, n), __rule(k, set, i)) == 0)
+      *__rule_op(k, __rule(k, set, n)) |= *__rule_op(k, __rule(k, set, i));
+    else if(++n != i)
+      memcpy(__rule(k, set, n), __rule(k, set, i), k->size);
+  }
+  set->count = n + 1;
+}
+
+static inline char* __trim(char* s){
+  char* end;
+
+  while(isspace((unsigned char)*s))
+    s++;
+  end = s + strlen(s);
+  while(end > s && isspace((unsigned char)end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+static int __policy_line(struct capture_policy* policy, int* section, char* line){
+  const struct rule_kind* k;
+  uint64_t id;
+  uint8_t* elt;
+  char* value;
+  size_t i;
+  int rc;
+
+  line = __trim(line);
+  if(*line == '\0' || *line == ';' || *line == '#')
+    return 0;
+  if(*line == '['){
+    value = strchr(line, ']');
+    if(value == NULL || value[1] != '\0')
+      return -EINVAL;
+    *value = '\0';
+    *section = -2; // not a filter section, ignored
+    if(strcmp(line + 1, "provenance") == 0)
+      *section = -1;
+    for(i = 0; i < RULE_KINDS; i++){
+      if(strcmp(line + 1, rule_kinds[i].section) == 0)
+        *section = i;
+    }
+    return 0;
+  }
+  if(*section == -2)
+    return 0;
+  value = strchr(line, '=');
+  if(value == NULL)
+    return -EINVAL;
+  *value = '\0';
+  line = __trim(line);
+  value = __trim(value + 1);
+  if(*section == -1){
+    for(i = 0; i < MASK_KINDS; i++){
+      if(strcmp(line, mask_kinds[i].key) != 0)
+        continue;
+      if(mask_kinds[i].relation)
+        id = relation_str_to_id(value, strlen(value));
+      else
+        id = node_str_to_id(value, strlen(value));
+      if(id == 0)
+        return -EINVAL;
+      policy->masks[i] |= id & SUBTYPE_MASK;
+      return 0;
+    }
+    return 0; // machine_id, enabled...
+  }
+  k = &rule_kinds[*section];
+  for(i = 0; i < sizeof(policy_ops)/sizeof(policy_ops[0]); i++){
+    if(strcmp(line, policy_ops[i].key) == 0)
+      break;
+  }
+  if(i == sizeof(policy_ops)/sizeof(policy_ops[0]) || (policy_ops[i].flag & k->allowed) == 0)
+    return -EINVAL;
+  elt = __rule_add(k, &policy->rules[*section]);
+  if(elt == NULL)
+    return -ENOMEM;
+  rc = k->parse(value, elt);
+  if(rc < 0){
+    policy->rules[*section].count--;
+    return -EINVAL;
+  }
+  *__rule_op(k, elt) = policy_ops[i].op;
+  return 0;
+}
+
+void provenance_policy_free(struct capture_policy* policy){
+  int i;
+
+  if(policy == NULL)
+    return;
+  for(i = 0; i < RULE_KINDS; i++)
+    free(policy->rules[i].elts);
+  free(policy);
+}
+
+struct capture_policy* provenance_policy_load(const char* path, int* line){
+  struct capture_policy* policy;
+  char* buf = NULL;
+  size_t len = 0;
+  int section = -2;
+  int n = 0;
+  int rc = 0;
+  int i;
+  FILE* f;
+
+  f = fopen(path, "re");
+  if(f == NULL)
+    return NULL;
+  policy = calloc(1, sizeof(struct capture_policy));
+  if(policy == NULL){
+    fclose(f);
+    return NULL;
+  }
+  while(getline(&buf, &len, f) >= 0){
+    n++;
+    rc = __policy_line(policy, &section, buf);
+    if(rc < 0)
+      break;
+  }
+  if(rc == 0 && ferror(f))
+    rc = -EIO;
+  free(buf);
+  fclose(f);
+  if(rc < 0){
+    if(line != NULL)
+      *line = n;
+    provenance_policy_free(policy);
+    errno = -rc;
+    return NULL;
+  }
+  for(i = 0; i < RULE_KINDS; i++)
+    __rule_normalise(&rule_kinds[i], &policy->rules[i]);
+  return policy;
+}
+
+/* read a rule list back, growing the buffer until it is not filled */
+static int __rule_read(const struct rule_kind* k, struct rule_set* set){
+  size_t count = 64;
+  uint8_t* tmp;
+  int rc;
+
+  for(;;){
+    tmp = realloc(set->elts, count*k->size);
+    if(tmp == NULL)
+      return -ENOMEM;
+    set->elts = tmp;
+    set->size = count;
+    rc = provenance_control_read(k->file, set->elts, count*k->size);
+    if(rc < 0 && errno != ENOMEM)
+      return -errno;
+    if(rc >= 0 && (size_t)rc < count*k->size)
+      break;
+    if(count >= POLICY_MAX_READ)
+      return -E2BIG;
+    count *= 2;
+  }
+  set->count = rc/k->size;
+  __rule_normalise(k, set);
+  return 0;
+}
+
+struct policy_change{
+  const struct rule_kind* kind;   // NULL for a type filter
+  const struct mask_kind* mask;
+  const uint8_t* elt;
+  uint8_t from;                   // previous operation, 0 if absent
+  uint8_t to;                     // new operation, 0 to delete
+  uint64_t add;                   // type filter bits
+  uint64_t remove;
+};
+
+struct change_list{
+  struct policy_change* changes;
+  size_t count;
+  size_t size;
+};
+
+static struct policy_change* __change_add(struct change_list* list){
+  struct policy_change* tmp;
+
+  if(list->count == list->size){
+    list->size = (list->size == 0) ? 64 : list->size*2;
+    tmp = realloc(list->changes, list->size*sizeof(struct policy_change));
+    if(tmp == NULL)
+      return NULL;
+    list->changes = tmp;
+  }
+  tmp = &list->changes[list->count++];
+  memset(tmp, 0, sizeof(struct policy_change));
+  return tmp;
+}
+
+static int __change_write(const struct policy_change* c, bool undo){
+  uint8_t elt[sizeof(struct secinfo)];
+  uint8_t op = undo ? c->from : c->to;
+  uint64_t add = undo ? c->remove : c->add;
+  uint64_t remove = undo ? c->add : c->remove;
+  int rc;
+
+  if(c->kind == NULL){
+    rc = (add != 0) ? c->mask->add(add) : c->mask->remove(remove);
+    return (rc < 0) ? -errno : 0;
+  }
+  memcpy(elt, c->elt, c->kind->size);
+  *__rule_op(c->kind, elt) = (op != 0) ? op : PROV_SET_DELETE;
+  rc = provenance_control_write(c->kind->file, elt, c->kind->size);
+  return (rc < 0) ? -errno : 0;
+}
+
+/* merge the sorted lists, additions and changes go to first, removals to last */
+static int __rule_diff(const struct rule_kind* k, const struct rule_set* want, const struct rule_set* have,
+                       struct change_list* first, struct change_list* last, struct policy_stats* stats){
+  struct policy_change* c;
+  uint8_t* w;
+  uint8_t* h;
+  size_t i = 0;
+  size_t j = 0;
+  int cmp;
+
+  while(i < want->count || j < have->count){
+    w = (i < want->count) ? __rule(k, want, i) : NULL;
+    h = (j < have->count) ? __rule(k, have, j) : NULL;
+    cmp = (w == NULL) ? 1 : (h == NULL) ? -1 : k->compare(w, h);
+    if(cmp == 0 && *__rule_op(k, w) == *__rule_op(k, h)){
+      stats->unchanged++;
+      i++;
+      j++;
+      continue;
+    }
+    c = __change_add((cmp > 0) ? last : first);
+    if(c == NULL)
+      return -ENOMEM;
+    c->kind = k;
+    if(cmp < 0){
+      c->elt = w;
+      c->to = *__rule_op(k, w);
+      stats->added++;
+      i++;
+    }else if(cmp > 0){
+      c->elt = h;
+      c->from = *__rule_op(k, h);
+      stats->removed++;
+      j++;
+    }else{
+      c->elt = w;
+      c->from = *__rule_op(k, h);
+      c->to = *__rule_op(k, w);
+      stats->changed++;
+      i++;
+      j++;
+    }
+  }
+  return 0;
+}
+
+static int __mask_diff(const struct mask_kind* m, uint64_t want, struct change_list* first,
+                       struct change_list* last, struct policy_stats* stats){
+  struct policy_change* c;
+  uint64_t have = 0;
+  int rc;
+
+  rc = m->get(&have);
+  if(rc < 0)
+    return -errno;
+  stats->unchanged += __builtin_popcountll(want & have);
+  if(want & ~have){
+    c = __change_add(first);
+    if(c == NULL)
+      return -ENOMEM;
+    c->mask = m;
+    c->add = want & ~have;
+    stats->added += __builtin_popcountll(c->add);
+  }
+  if(have & ~want){
+    c = __change_add(last);
+    if(c == NULL)
+      return -ENOMEM;
+    c->mask = m;
+    c->remove = have & ~want;
+    stats->removed += __builtin_popcountll(c->remove);
+  }
+  return 0;
+}
+
+int provenance_policy_apply(const struct capture_policy* policy, bool dry_run, struct policy_stats* stats){
+  struct rule_set have[RULE_KINDS];
+  struct change_list first;
+  struct change_list last;
+  struct policy_stats s;
+  struct policy_change* c;
+  size_t n = 0;
+  int rc = 0;
+  int i;
+
+  memset(&s, 0, sizeof(struct policy_stats));
+  memset(have, 0, sizeof(have));
+  memset(&first, 0, sizeof(struct change_list));
+  memset(&last, 0, sizeof(struct change_list));
+  for(i = 0; i < RULE_KINDS && rc == 0; i++){
+    rc = __rule_read(&rule_kinds[i], &have[i]);
+    if(rc == 0)
+      rc = __rule_diff(&rule_kinds[i], &policy->rules[i], &have[i], &first, &last, &s);
+  }
+  for(i = 0; i < MASK_KINDS && rc == 0; i++)
+    rc = __mask_diff(&mask_kinds[i], policy->masks[i], &first, &last, &s);
+  if(rc < 0 || dry_run)
+    goto out;
+  for(n = 0; n < first.count + last.count; n++){
+    c = (n < first.count) ? &first.changes[n] : &last.changes[n - first.count];
+    rc = __change_write(c, false);
+    s.writes++;
+    if(rc < 0)
+      break;
+  }
+  if(rc < 0){ // put back what was changed, the failed write did nothing
+    while(n-- > 0){
+      c = (n < first.count) ? &first.changes[n] : &last.changes[n - first.count];
+      __change_write(c, true);
+      s.writes++;
+    }
+  }
+out:
+  if(stats != NULL)
+    memcpy(stats, &s, sizeof(struct policy_stats));
+  for(i = 0; i < RULE_KINDS; i++)
+    free(have[i].elts);
+  free(first.changes);
+  free(last.changes);
+  return rc;
+}
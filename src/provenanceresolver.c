@@ -0,0 +1,242 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "provenanceutils.h"
+
+/*
+* Reverse lookups are performed by a single background thread. Serialisation
+* only ever try-locks the cache: on contention, miss or expired entry it
+* queues a request (if there is room) and carries on without a hostname.
+*/
+#define RESOLVER_CACHE_SIZE   4096
+#define RESOLVER_QUEUE_SIZE   256
+#define RESOLVER_HOST_LEN     256
+
+struct resolver_key {
+  sa_family_t family;
+  uint8_t addr[16];
+};
+
+struct resolver_entry {
+  struct resolver_key key;
+  time_t expire;
+  bool used;
+  bool pending;
+  bool resolved;
+  char host[RESOLVER_HOST_LEN];
+};
+
+static struct resolver_entry *cache = NULL;
+static struct sockaddr_storage queue[RESOLVER_QUEUE_SIZE];
+static socklen_t queue_len[RESOLVER_QUEUE_SIZE];
+static uint32_t queue_head = 0;
+static uint32_t queue_tail = 0;
+static pthread_mutex_t l_cache = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t l_queue = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_queue = PTHREAD_COND_INITIALIZER;
+static pthread_t resolver_thread;
+static uint32_t resolver_ttl = 0;
+static resolver_fcn resolver = NULL;
+static bool resolver_running = false;  // read by serialising threads, accessed atomically
+
+static int default_resolver(const struct sockaddr* addr, socklen_t length, char* host, size_t hostlen){
+  return getnameinfo(addr, length, host, hostlen, NULL, 0, NI_NAMEREQD);
+}
+
+static inline bool __addr_to_key(const struct sockaddr* addr, struct resolver_key* key){
+  memset(key, 0, sizeof(struct resolver_key));
+  key->family = addr->sa_family;
+  if(addr->sa_family == AF_INET){
+    memcpy(key->addr, &((struct sockaddr_in*)addr)->sin_addr, sizeof(struct in_addr));
+    return true;
+  }else if(addr->sa_family == AF_INET6){
+    memcpy(key->addr, &((struct sockaddr_in6*)addr)->sin6_addr, sizeof(struct in6_addr));
+    return true;
+  }
+  return false;
+}
+
+static inline uint32_t __key_slot(const struct resolver_key* key){
+  uint32_t h = 2166136261U ^ key->family;
+  int i;
+
+  for(i = 0; i < 16; i++){
+    h ^= key->addr[i];
+    h *= 16777619U;
+  }
+  return h % RESOLVER_CACHE_SIZE;
+}
+
+static inline time_t __now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec;
+}
+
+static bool __enqueue(const struct sockaddr* addr, socklen_t length){
+  bool rc = false;
+
+  if(length > sizeof(struct sockaddr_storage))
+    return false;
+  pthread_mutex_lock(&l_queue);
+  if(queue_tail - queue_head < RESOLVER_QUEUE_SIZE){
+    memcpy(&queue[queue_tail % RESOLVER_QUEUE_SIZE], addr, length);
+    queue_len[queue_tail % RESOLVER_QUEUE_SIZE] = length;
+    queue_tail++;
+    pthread_cond_signal(&c_queue);
+    rc = true;
+  }
+  pthread_mutex_unlock(&l_queue);
+  return rc;
+}
+
+static void* resolver_job(void* data){
+  struct sockaddr_storage addr;
+  struct resolver_key key;
+  struct resolver_entry* e;
+  char host[RESOLVER_HOST_LEN];
+  socklen_t length;
+  int rc;
+
+  while(1){
+    pthread_mutex_lock(&l_queue);
+    while(__atomic_load_n(&resolver_running, __ATOMIC_ACQUIRE) && queue_head == queue_tail)
+      pthread_cond_wait(&c_queue, &l_queue);
+    if(!__atomic_load_n(&resolver_running, __ATOMIC_ACQUIRE)){
+      pthread_mutex_unlock(&l_queue);
+      break;
+    }
+    memcpy(&addr, &queue[queue_head % RESOLVER_QUEUE_SIZE], sizeof(struct sockaddr_storage));
+    length = queue_len[queue_head % RESOLVER_QUEUE_SIZE];
+    queue_head++;
+    pthread_mutex_unlock(&l_queue);
+
+    host[0] = '\0';
+    rc = resolver((struct sockaddr*)&addr, length, host, RESOLVER_HOST_LEN);
+    __addr_to_key((struct sockaddr*)&addr, &key);
+    pthread_mutex_lock(&l_cache);
+    e = &cache[__key_slot(&key)];
+    memcpy(&e->key, &key, sizeof(struct resolver_key));
+    e->used = true;
+    e->pending = false;
+    e->resolved = (rc == 0 && host[0] != '\0');
+    e->expire = __now() + resolver_ttl;
+    memcpy(e->host, host, RESOLVER_HOST_LEN);
+    e->host[RESOLVER_HOST_LEN-1] = '\0';
+    pthread_mutex_unlock(&l_cache);
+  }
+  return NULL;
+}
+
+int provenance_resolver_start(uint32_t ttl, resolver_fcn fcn){
+  int rc;
+
+  struct resolver_entry* c;
+
+  if(__atomic_load_n(&resolver_running, __ATOMIC_ACQUIRE))
+    return -EBUSY;
+  c = calloc(RESOLVER_CACHE_SIZE, sizeof(struct resolver_entry));
+  if(c == NULL)
+    return -ENOMEM;
+  pthread_mutex_lock(&l_cache);
+  cache = c;
+  pthread_mutex_unlock(&l_cache);
+  resolver_ttl = ttl;
+  resolver = (fcn != NULL) ? fcn : default_resolver;
+  pthread_mutex_lock(&l_queue);
+  queue_head = queue_tail = 0;
+  pthread_mutex_unlock(&l_queue);
+  __atomic_store_n(&resolver_running, true, __ATOMIC_RELEASE);
+  rc = pthread_create(&resolver_thread, NULL, resolver_job, NULL);
+  if(rc != 0){
+    __atomic_store_n(&resolver_running, false, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&l_cache);
+    free(cache);
+    cache = NULL;
+    pthread_mutex_unlock(&l_cache);
+    return -rc;
+  }
+  return 0;
+}
+
+void provenance_resolver_stop(void){
+  if(!__atomic_load_n(&resolver_running, __ATOMIC_ACQUIRE))
+    return;
+  pthread_mutex_lock(&l_queue);
+  __atomic_store_n(&resolver_running, false, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&c_queue);
+  pthread_mutex_unlock(&l_queue);
+  pthread_join(resolver_thread, NULL);
+  pthread_mutex_lock(&l_cache);
+  free(cache);
+  cache = NULL;
+  pthread_mutex_unlock(&l_cache);
+}
+
+int provenance_resolver_lookup(const struct sockaddr* addr, socklen_t length, char* host, size_t hostlen){
+  struct resolver_key key;
+  struct resolver_entry* e;
+  bool request = false;
+  int rc = -EAGAIN;
+
+  if(!__atomic_load_n(&resolver_running, __ATOMIC_ACQUIRE))
+    return -ENOENT;
+  if(!__addr_to_key(addr, &key))
+    return -EINVAL;
+  if(pthread_mutex_trylock(&l_cache) != 0)
+    return -EAGAIN; // never wait on the resolver
+  if(cache == NULL){
+    pthread_mutex_unlock(&l_cache);
+    return -ENOENT;
+  }
+  e = &cache[__key_slot(&key)];
+  if(e->used && memcmp(&e->key, &key, sizeof(struct resolver_key)) == 0){
+    if(e->pending){
+      rc = -EAGAIN;
+    }else if(e->expire < __now()){
+      e->pending = request = true;
+    }else if(e->resolved){
+      strncpy(host, e->host, hostlen);
+      host[hostlen-1] = '\0';
+      rc = 0;
+    }else{
+      rc = -ENOENT; // negative entry
+    }
+  }else if(!e->used || !e->pending){
+    memcpy(&e->key, &key, sizeof(struct resolver_key));
+    e->used = e->pending = request = true;
+    e->resolved = false;
+  }
+  pthread_mutex_unlock(&l_cache);
+  if(request && !__enqueue(addr, length)){ // queue full, retry later
+    pthread_mutex_lock(&l_cache);
+    // the slot may have been taken by another address, or the cache replaced
+    if(cache != NULL){
+      e = &cache[__key_slot(&key)];
+      if(e->used && e->pending && memcmp(&e->key, &key, sizeof(struct resolver_key)) == 0){
+        e->pending = false;
+        e->expire = 0;
+      }
+    }
+    pthread_mutex_unlock(&l_cache);
+  }
+  return rc;
+}
@@ -0,0 +1,869 @@
+/*
+*
+* Author: Thomas Pasquier <tfjmp2@cl.cam.ac.uk>
+*
+* Copyright (C) 2015-2018 University of Cambridge, Harvard University
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2, as
+* published by the Free Software Foundation.
+*
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "provenanceutils.h"
+#include "provenancesink.h"
+
+int provenance_sink_write(struct provenance_sink* sink, const void* data, size_t length){
+  int rc;
+
+  pthread_mutex_lock(&sink->lock);
+  rc = sink->ops->write(sink, data, length);
+  pthread_mutex_unlock(&sink->lock);
+  return rc;
+}
+
+int provenance_sink_flush(struct provenance_sink* sink){
+  int rc;
+
+  pthread_mutex_lock(&sink->lock);
+  rc = sink->ops->flush(sink);
+  pthread_mutex_unlock(&sink->lock);
+  return rc;
+}
+
+void provenance_sink_close(struct provenance_sink* sink){
+  sink->ops->close(sink);
+}
+
+int provenance_sink_stats(struct provenance_sink* sink, struct sink_stats* stats){
+  pthread_mutex_lock(&sink->lock);
+  memcpy(stats, &sink->stats, sizeof(struct sink_stats));
+  pthread_mutex_unlock(&sink->lock);
+  return 0;
+}
+
+static inline int __write_all(int fd, const uint8_t* buf, size_t length){
+  ssize_t rc;
+
+  while(length > 0){
+    rc = write(fd, buf, length);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    buf += rc;
+    length -= rc;
+  }
+  return 0;
+}
+
+static inline uint64_t __now_ms(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/* file sink */
+#define FILE_SINK_ALIGN 4096
+
+struct file_sink{
+  struct provenance_sink sink;
+  struct file_sink_config config;
+  char path[PATH_MAX];
+  int fd;
+  uint8_t* buf;
+  size_t size;
+  size_t used;
+  uint64_t written;     // bytes written to the current file, buffered included
+  time_t opened;
+  uint32_t sequence;
+  bool dirty;           // data not yet durable
+  uint64_t last_sync;
+  bool sync_running;
+  pthread_t sync_thread;
+  pthread_cond_t sync_cond;
+};
+
+/*
+* @all write everything, otherwise with O_DIRECT the trailing partial block
+* stays in the buffer.
+*/
+static int __file_drain(struct file_sink* fs, bool all){
+  size_t len = fs->used;
+  size_t aligned;
+  int rc;
+
+  if(len == 0)
+    return 0;
+  if(!fs->config.direct){
+    rc = __write_all(fs->fd, fs->buf, len);
+    if(rc < 0)
+      return rc;
+    fs->used = 0;
+    return 0;
+  }
+  aligned = len & ~((size_t)FILE_SINK_ALIGN-1);
+  if(aligned > 0){
+    rc = __write_all(fs->fd, fs->buf, aligned);
+    if(rc < 0)
+      return rc;
+  }
+  if(all && aligned < len){ // the file ends here, O_DIRECT can be dropped
+    fcntl(fs->fd, F_SETFL, fcntl(fs->fd, F_GETFL) & ~O_DIRECT);
+    rc = __write_all(fs->fd, fs->buf+aligned, len-aligned);
+    if(rc < 0)
+      return rc;
+    aligned = len;
+  }
+  memmove(fs->buf, fs->buf+aligned, len-aligned);
+  fs->used = len-aligned;
+  return 0;
+}
+
+static int __file_sync(struct file_sink* fs){
+  int rc;
+
+  rc = __file_drain(fs, !fs->config.direct);
+  if(rc < 0)
+    return rc;
+  if(fdatasync(fs->fd) < 0)
+    return -errno;
+  fs->dirty = (fs->used > 0); // with O_DIRECT, a partial block stays buffered
+  fs->last_sync = __now_ms();
+  return 0;
+}
+
+static int __file_open(struct file_sink* fs){
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+  if(fs->config.direct)
+    flags |= O_DIRECT;
+  fs->fd = open(fs->path, flags, 0640);
+  if(fs->fd < 0)
+    return -errno;
+  fs->written = 0;
+  fs->opened = time(NULL);
+  return 0;
+}
+
+/* move the current file out of the way */
+static int __file_retire(struct file_sink* fs){
+  char rotated[PATH_MAX+64];
+
+  snprintf(rotated, sizeof(rotated), "%s.%lld.%u", fs->path, (long long)time(NULL), fs->sequence++);
+  if(rename(fs->path, rotated) < 0 && errno != ENOENT)
+    return -errno;
+  return 0;
+}
+
+static int __file_rotate(struct file_sink* fs){
+  int rc;
+
+  rc = __file_drain(fs, true);
+  if(rc < 0)
+    return rc;
+  if(fdatasync(fs->fd) < 0)
+    return -errno;
+  close(fs->fd);
+  fs->fd = -1;
+  fs->dirty = false;
+  rc = __file_retire(fs);
+  if(rc < 0)
+    return rc;
+  return __file_open(fs);
+}
+
+/* a failed rotation leaves no file open, retry it before the file is used */
+static inline int __file_ready(struct file_sink* fs){
+  int rc;
+
+  if(fs->fd >= 0)
+    return 0;
+  rc = __file_retire(fs); // never truncate the previous file
+  if(rc < 0)
+    return rc;
+  return __file_open(fs);
+}
+
+static inline int __file_append(struct file_sink* fs, const uint8_t* data, size_t length){
+  size_t n;
+  int rc;
+
+  fs->written += length;
+  while(length > 0){
+    n = fs->size - fs->used;
+    if(n > length)
+      n = length;
+    memcpy(fs->buf+fs->used, data, n);
+    fs->used += n;
+    data += n;
+    length -= n;
+    if(fs->used == fs->size){
+      rc = __file_drain(fs, false);
+      if(rc < 0)
+        return rc;
+    }
+  }
+  return 0;
+}
+
+/* NDJSON, drop line breaks so that the value holds on one line */
+static inline int __file_append_line(struct file_sink* fs, const uint8_t* data, size_t length){
+  const uint8_t* end = data + length;
+  const uint8_t* p;
+  int rc;
+
+  while(data < end){
+    for(p = data; p < end && *p != '\n' && *p != '\r'; p++);
+    rc = __file_append(fs, data, p - data);
+    if(rc < 0)
+      return rc;
+    data = p + 1;
+  }
+  return 0;
+}
+
+static int file_write(struct provenance_sink* sink, const void* data, size_t length){
+  struct file_sink* fs = (struct file_sink*)sink->priv;
+  int rc;
+
+  rc = __file_ready(fs);
+  if(rc < 0)
+    return rc;
+  if(fs->written > 0
+    && ((fs->config.rotate_size > 0 && fs->written + length + 1 > fs->config.rotate_size)
+    || (fs->config.rotate_interval > 0 && time(NULL) - fs->opened >= fs->config.rotate_interval))){
+    rc = __file_rotate(fs);
+    if(rc < 0)
+      return rc;
+  }
+  sink->stats.batches++;
+  sink->stats.bytes += length;
+  switch(sink->format){
+    case SINK_PROVJSON:
+      rc = __file_append(fs, data, length);
+      if(rc == 0)
+        rc = __file_append(fs, (const uint8_t*)"\n", 1);
+      break;
+    case SINK_NDJSON:
+      rc = __file_append_line(fs, data, length);
+      if(rc == 0)
+        rc = __file_append(fs, (const uint8_t*)"\n", 1);
+      break;
+    default:
+      rc = __file_append(fs, data, length);
+  }
+  if(rc < 0)
+    return rc;
+  fs->dirty = true;
+  if(fs->config.sync_interval > 0 && __now_ms() - fs->last_sync >= fs->config.sync_interval)
+    return __file_sync(fs);
+  return 0;
+}
+
+static int file_flush(struct provenance_sink* sink){
+  struct file_sink* fs = (struct file_sink*)sink->priv;
+  int rc;
+
+  rc = __file_ready(fs);
+  if(rc < 0)
+    return rc;
+  return __file_drain(fs, !fs->config.direct);
+}
+
+/* make data durable when no write comes to do it */
+static void* file_sync_job(void* data){
+  struct file_sink* fs = (struct file_sink*)data;
+  struct timespec deadline;
+  uint64_t ns;
+
+  pthread_mutex_lock(&fs->sink.lock);
+  while(fs->sync_running){
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    ns = deadline.tv_nsec + (uint64_t)fs->config.sync_interval*1000000;
+    deadline.tv_sec += ns/1000000000;
+    deadline.tv_nsec = ns%1000000000;
+    pthread_cond_timedwait(&fs->sync_cond, &fs->sink.lock, &deadline);
+    if(fs->dirty && fs->fd >= 0 && __now_ms() - fs->last_sync >= fs->config.sync_interval)
+      __file_sync(fs);
+  }
+  pthread_mutex_unlock(&fs->sink.lock);
+  return NULL;
+}
+
+static void file_close(struct provenance_sink* sink){
+  struct file_sink* fs = (struct file_sink*)sink->priv;
+
+  if(fs->sync_running){
+    pthread_mutex_lock(&sink->lock);
+    fs->sync_running = false;
+    pthread_cond_signal(&fs->sync_cond);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(fs->sync_thread, NULL);
+  }
+  if(fs->fd >= 0){
+    __file_drain(fs, true);
+    fdatasync(fs->fd);
+    close(fs->fd);
+  }
+  pthread_cond_destroy(&fs->sync_cond);
+  pthread_mutex_destroy(&sink->lock);
+  free(fs->buf);
+  free(fs);
+}
+
+static const struct sink_ops file_sink_ops = {
+  .write = file_write,
+  .flush = file_flush,
+  .close = file_close
+};
+
+struct provenance_sink* provenance_file_sink(const struct file_sink_config* config){
+  struct file_sink* fs;
+  int rc;
+
+  if(config == NULL || config->path == NULL || strlen(config->path) >= PATH_MAX){
+    errno = EINVAL;
+    return NULL;
+  }
+  fs = (struct file_sink*)calloc(1, sizeof(struct file_sink));
+  if(fs == NULL)
+    return NULL;
+  memcpy(&fs->config, config, sizeof(struct file_sink_config));
+  strncpy(fs->path, config->path, PATH_MAX-1);
+  fs->config.path = fs->path;
+  fs->size = (config->buffer_size == 0) ? FILE_SINK_DEFAULT_BUFFER : config->buffer_size;
+  fs->size = (fs->size + FILE_SINK_ALIGN - 1) & ~((size_t)FILE_SINK_ALIGN-1);
+  rc = posix_memalign((void**)&fs->buf, FILE_SINK_ALIGN, fs->size);
+  if(rc != 0){
+    free(fs);
+    errno = rc;
+    return NULL;
+  }
+  // never append to a previous file, it may not be block aligned
+  rc = __file_retire(fs);
+  if(rc == 0)
+    rc = __file_open(fs);
+  if(rc < 0)
+    goto error;
+  fs->last_sync = __now_ms();
+  fs->sink.ops = &file_sink_ops;
+  fs->sink.format = config->format;
+  fs->sink.priv = fs;
+  pthread_mutex_init(&fs->sink.lock, NULL);
+  pthread_cond_init(&fs->sync_cond, NULL);
+  if(config->sync_interval > 0){
+    fs->sync_running = true;
+    rc = -pthread_create(&fs->sync_thread, NULL, file_sync_job, fs);
+    if(rc < 0){
+      fs->sync_running = false;
+      close(fs->fd);
+      pthread_cond_destroy(&fs->sync_cond);
+      pthread_mutex_destroy(&fs->sink.lock);
+      goto error;
+    }
+  }
+  return &fs->sink;
+
+error:
+  free(fs->buf);
+  free(fs);
+  errno = -rc;
+  return NULL;
+}
+
+/* socket sink */
+#define SOCKET_SINK_CHUNK     (64*1024)
+#define SOCKET_SINK_RETRY     100 // ms between connection attempts
+#define SOCKET_SINK_POLL      100 // ms
+
+struct sink_batch{
+  uint8_t* data;
+  size_t length;
+};
+
+struct socket_sink{
+  struct provenance_sink sink;
+  struct socket_sink_config config;
+  char address[PATH_MAX];
+  char spill[PATH_MAX];
+  int fd;
+  /* in memory queue, ring of batches */
+  struct sink_batch* queue;
+  uint32_t queue_length;
+  uint32_t head;
+  uint32_t count;
+  size_t head_sent;     // bytes of the head batch already sent
+  size_t queued_bytes;
+  /* spill file, once spilling every batch goes there until it is replayed */
+  int spill_fd;
+  bool spilling;
+  uint64_t spill_size;
+  uint64_t spill_sent;
+  uint64_t spill_mark;  // end of the last batch replayed entirely
+  uint8_t* chunk;       // replay buffer, SOCKET_SINK_CHUNK bytes
+  bool running;
+  pthread_t sender;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+/* total length of a compressed frame (see compress_stream_frame) from its header */
+static inline uint64_t __frame_length(const uint8_t* header){
+  return COMPRESS_FRAME_HEADER_LENGTH
+    + (((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3]);
+}
+
+static int __socket_connect(const char* address){
+  struct sockaddr_storage addr;
+  struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+  struct sockaddr_in* in4 = (struct sockaddr_in*)&addr;
+  struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+  char host[INET6_ADDRSTRLEN];
+  const char* port;
+  socklen_t len;
+  size_t hlen;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  if(address[0] == '/' || address[0] == '@'){
+    un->sun_family = AF_UNIX;
+    strncpy(un->sun_path, address, sizeof(un->sun_path)-1);
+    len = offsetof(struct sockaddr_un, sun_path) + strlen(un->sun_path);
+    if(address[0] == '@') // abstract socket
+      un->sun_path[0] = '\0';
+  }else{
+    port = strrchr(address, ':');
+    if(port == NULL)
+      return -EINVAL;
+    if(address[0] == '['){
+      address++;
+      hlen = port - address - 1;
+    }else
+      hlen = port - address;
+    if(hlen >= INET6_ADDRSTRLEN)
+      return -EINVAL;
+    memcpy(host, address, hlen);
+    host[hlen] = '\0';
+    if(inet_pton(AF_INET, host, &in4->sin_addr) == 1){
+      in4->sin_family = AF_INET;
+      in4->sin_port = htons(atoi(port+1));
+      len = sizeof(struct sockaddr_in);
+    }else if(inet_pton(AF_INET6, host, &in6->sin6_addr) == 1){
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons(atoi(port+1));
+      len = sizeof(struct sockaddr_in6);
+    }else
+      return -EINVAL;
+  }
+  fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return -errno;
+  if(connect(fd, (struct sockaddr*)&addr, len) < 0){
+    close(fd);
+    return -errno;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+/* copy the batch as it is framed on the wire */
+static uint8_t* __socket_frame(enum sink_format format, const uint8_t* data, size_t length, size_t* framed){
+  uint8_t* out = malloc(length + 1);
+  size_t i, n = 0;
+
+  if(out == NULL)
+    return NULL;
+  switch(format){
+    case SINK_PROVJSON:
+      memcpy(out, data, length);
+      n = length;
+      out[n++] = '\n';
+      break;
+    case SINK_NDJSON:
+      for(i=0; i<length; i++){
+        if(data[i] != '\n' && data[i] != '\r')
+          out[n++] = data[i];
+      }
+      out[n++] = '\n';
+      break;
+    default:
+      memcpy(out, data, length);
+      n = length;
+  }
+  *framed = n;
+  return out;
+}
+
+static int __socket_spill(struct socket_sink* ss, const uint8_t* data, size_t length){
+  ssize_t rc;
+  size_t done = 0;
+
+  if(ss->spill_fd < 0){
+    ss->spill_fd = open(ss->spill, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if(ss->spill_fd < 0)
+      return -errno;
+  }
+  while(done < length){
+    rc = pwrite(ss->spill_fd, data+done, length-done, ss->spill_size+done);
+    if(rc < 0){
+      if(errno == EINTR)
+        continue;
+      return -errno;
+    }
+    done += rc;
+  }
+  ss->spill_size += length;
+  ss->spilling = true;
+  ss->sink.stats.spilled_batches++;
+  ss->sink.stats.spilled_bytes += length;
+  pthread_cond_signal(&ss->not_empty);
+  return 0;
+}
+
+static int socket_write(struct provenance_sink* sink, const void* data, size_t length){
+  struct socket_sink* ss = (struct socket_sink*)sink->priv;
+  struct sink_batch* batch;
+  uint8_t* framed;
+  size_t n;
+  int rc;
+
+  if(sink->format == SINK_BINARY // spill replay walks the frame headers
+    && (length < COMPRESS_FRAME_HEADER_LENGTH || __frame_length(data) != length))
+    return -EINVAL;
+  framed = __socket_frame(sink->format, data, length, &n);
+  if(framed == NULL)
+    return -ENOMEM;
+  sink->stats.batches++;
+  sink->stats.bytes += n;
+  if(ss->spilling){ // keep ordering, memory queue is drained first
+    rc = __socket_spill(ss, framed, n);
+    free(framed);
+    return rc;
+  }
+  if(ss->count == ss->queue_length || ss->queued_bytes + n > ss->config.queue_size){
+    switch(ss->config.policy){
+      case SINK_DROP:
+        sink->stats.dropped_batches++;
+        sink->stats.dropped_bytes += n;
+        free(framed);
+        return -ENOBUFS;
+      case SINK_SPILL:
+        rc = __socket_spill(ss, framed, n);
+        free(framed);
+        return rc;
+      default:
+        sink->stats.blocked++;
+        // an oversized batch is let through once the queue is empty
+        while(ss->running && ss->count > 0
+          && (ss->count == ss->queue_length || ss->queued_bytes + n > ss->config.queue_size))
+          pthread_cond_wait(&ss->not_full, &sink->lock);
+    }
+  }
+  batch = &ss->queue[(ss->head + ss->count) % ss->queue_length];
+  batch->data = framed;
+  batch->length = n;
+  ss->count++;
+  ss->queued_bytes += n;
+  pthread_cond_signal(&ss->not_empty);
+  return 0;
+}
+
+static int socket_flush(struct provenance_sink* sink){
+  struct socket_sink* ss = (struct socket_sink*)sink->priv;
+
+  while(ss->running && ss->fd >= 0 && (ss->count > 0 || ss->spilling))
+    pthread_cond_wait(&ss->not_full, &sink->lock);
+  return (ss->count > 0 || ss->spilling) ? -ENOTCONN : 0;
+}
+
+/* called without lock, return bytes sent, 0 if the socket is full, <0 on error */
+static ssize_t __socket_send(int fd, struct iovec* iov, int iovcnt){
+  struct msghdr msg;
+  struct pollfd pfd;
+  ssize_t rc;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  rc = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if(rc >= 0)
+    return rc;
+  if(errno == EINTR)
+    return 0;
+  if(errno != EAGAIN && errno != EWOULDBLOCK)
+    return -errno;
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  poll(&pfd, 1, SOCKET_SINK_POLL);
+  return 0;
+}
+
+static void __socket_disconnect(struct socket_sink* ss){
+  close(ss->fd);
+  ss->fd = -1;
+  ss->head_sent = 0; // the peer lost the partial batch, send it again
+  ss->spill_sent = ss->spill_mark;
+}
+
+/* send queued batches, lock held on entry and exit */
+static void __socket_send_queue(struct socket_sink* ss){
+  struct iovec iov[IOV_MAX];
+  struct sink_batch* batch;
+  uint32_t i;
+  int iovcnt = 0;
+  int fd = ss->fd;
+  ssize_t rc;
+  size_t n;
+
+  for(i=0; i<ss->count && iovcnt<IOV_MAX; i++){
+    batch = &ss->queue[(ss->head + i) % ss->queue_length];
+    iov[iovcnt].iov_base = batch->data + (i == 0 ? ss->head_sent : 0);
+    iov[iovcnt].iov_len = batch->length - (i == 0 ? ss->head_sent : 0);
+    iovcnt++;
+  }
+  pthread_mutex_unlock(&ss->sink.lock);
+  rc = __socket_send(fd, iov, iovcnt);
+  pthread_mutex_lock(&ss->sink.lock);
+  if(rc < 0){
+    __socket_disconnect(ss);
+    return;
+  }
+  n = rc;
+  while(n > 0){ // batches are only removed here, the iovec still matches the queue
+    batch = &ss->queue[ss->head];
+    if(n < batch->length - ss->head_sent){
+      ss->head_sent += n;
+      break;
+    }
+    n -= batch->length - ss->head_sent;
+    ss->queued_bytes -= batch->length;
+    free(batch->data);
+    ss->head = (ss->head + 1) % ss->queue_length;
+    ss->count--;
+    ss->head_sent = 0;
+  }
+  pthread_cond_broadcast(&ss->not_full);
+}
+
+/*
+* binary batches are compressed frames (checked by socket_write), return the
+* end of the last frame sent entirely. chunk holds the rc bytes sent from
+* offset, headers outside of it are read back from the spill file.
+*/
+static uint64_t __spill_frames(struct socket_sink* ss, const uint8_t* chunk, uint64_t offset, size_t rc){
+  uint8_t header[COMPRESS_FRAME_HEADER_LENGTH];
+  uint64_t mark = ss->spill_mark;
+  uint64_t end;
+
+  while(mark + COMPRESS_FRAME_HEADER_LENGTH <= ss->spill_sent){
+    if(mark >= offset && mark + COMPRESS_FRAME_HEADER_LENGTH <= offset + rc)
+      memcpy(header, chunk + (mark - offset), COMPRESS_FRAME_HEADER_LENGTH);
+    else if(pread(ss->spill_fd, header, COMPRESS_FRAME_HEADER_LENGTH, mark) != COMPRESS_FRAME_HEADER_LENGTH)
+      break;
+    end = mark + __frame_length(header);
+    if(end > ss->spill_sent)
+      break;
+    mark = end;
+  }
+  return mark;
+}
+
+/* replay the spill file, lock held on entry and exit */
+static void __socket_send_spill(struct socket_sink* ss, uint8_t* chunk){
+  struct iovec iov;
+  int fd = ss->fd;
+  int spill_fd = ss->spill_fd;
+  uint64_t offset = ss->spill_sent;
+  size_t len = SOCKET_SINK_CHUNK;
+  ssize_t rc;
+
+  if(ss->spill_size - offset < len)
+    len = ss->spill_size - offset;
+  pthread_mutex_unlock(&ss->sink.lock);
+  rc = pread(spill_fd, chunk, len, offset); // already written region, no lock needed
+  if(rc > 0){
+    iov.iov_base = chunk;
+    iov.iov_len = rc;
+    rc = __socket_send(fd, &iov, 1);
+  }else if(rc == 0)
+    rc = -EIO;
+  pthread_mutex_lock(&ss->sink.lock);
+  if(rc < 0){
+    __socket_disconnect(ss);
+    return;
+  }
+  ss->spill_sent += rc;
+  if(ss->sink.format == SINK_BINARY)
+    ss->spill_mark = __spill_frames(ss, chunk, offset, rc);
+  else{
+    while(rc > 0 && chunk[rc-1] != '\n')
+      rc--;
+    if(rc > 0)
+      ss->spill_mark = offset + rc;
+  }
+  if(ss->spill_sent == ss->spill_size){ // caught up, back to the memory queue
+    if(ftruncate(ss->spill_fd, 0) == 0){
+      ss->spill_size = 0;
+      ss->spill_sent = 0;
+      ss->spill_mark = 0;
+      ss->spilling = false;
+    }
+    pthread_cond_broadcast(&ss->not_full);
+  }
+}
+
+static void* socket_sender_job(void* data){
+  struct socket_sink* ss = (struct socket_sink*)data;
+  struct timespec s;
+  int fd;
+
+  s.tv_sec = 0;
+  s.tv_nsec = SOCKET_SINK_RETRY*1000000L;
+  pthread_mutex_lock(&ss->sink.lock);
+  while(ss->running || ss->count > 0 || ss->spilling){
+    while(ss->running && ss->count == 0 && !ss->spilling)
+      pthread_cond_wait(&ss->not_empty, &ss->sink.lock);
+    if(ss->fd < 0){
+      if(!ss->running) // give up, nobody is listening
+        break;
+      pthread_mutex_unlock(&ss->sink.lock);
+      fd = __socket_connect(ss->address);
+      if(fd < 0)
+        nanosleep(&s, NULL);
+      pthread_mutex_lock(&ss->sink.lock);
+      if(fd >= 0){
+        ss->fd = fd;
+        ss->sink.stats.reconnections++;
+      }
+      continue;
+    }
+    if(ss->count > 0)
+      __socket_send_queue(ss);
+    else if(ss->spilling)
+      __socket_send_spill(ss, ss->chunk);
+  }
+  // drop what could not be delivered
+  while(ss->count > 0){
+    ss->sink.stats.dropped_batches++;
+    ss->sink.stats.dropped_bytes += ss->queue[ss->head].length;
+    free(ss->queue[ss->head].data);
+    ss->head = (ss->head + 1) % ss->queue_length;
+    ss->count--;
+  }
+  pthread_cond_broadcast(&ss->not_full);
+  pthread_mutex_unlock(&ss->sink.lock);
+  return NULL;
+}
+
+static void socket_close(struct provenance_sink* sink){
+  struct socket_sink* ss = (struct socket_sink*)sink->priv;
+
+  pthread_mutex_lock(&sink->lock);
+  ss->running = false;
+  pthread_cond_broadcast(&ss->not_empty);
+  pthread_cond_broadcast(&ss->not_full);
+  pthread_mutex_unlock(&sink->lock);
+  pthread_join(ss->sender, NULL);
+  if(ss->fd >= 0)
+    close(ss->fd);
+  if(ss->spill_fd >= 0){
+    close(ss->spill_fd);
+    if(!ss->spilling)
+      unlink(ss->spill);
+  }
+  pthread_cond_destroy(&ss->not_empty);
+  pthread_cond_destroy(&ss->not_full);
+  pthread_mutex_destroy(&sink->lock);
+  free(ss->chunk);
+  free(ss->queue);
+  free(ss);
+}
+
+static const struct sink_ops socket_sink_ops = {
+  .write = socket_write,
+  .flush = socket_flush,
+  .close = socket_close
+};
+
+struct provenance_sink* provenance_socket_sink(const struct socket_sink_config* config){
+  struct socket_sink* ss;
+  int rc;
+
+  if(config == NULL || config->address == NULL || strlen(config->address) >= PATH_MAX
+    || (config->policy == SINK_SPILL && (config->spill_path == NULL || strlen(config->spill_path) >= PATH_MAX))){
+    errno = EINVAL;
+    return NULL;
+  }
+  ss = (struct socket_sink*)calloc(1, sizeof(struct socket_sink));
+  if(ss == NULL)
+    return NULL;
+  memcpy(&ss->config, config, sizeof(struct socket_sink_config));
+  strncpy(ss->address, config->address, PATH_MAX-1);
+  ss->config.address = ss->address;
+  if(config->spill_path != NULL)
+    strncpy(ss->spill, config->spill_path, PATH_MAX-1);
+  ss->config.spill_path = ss->spill;
+  if(ss->config.queue_size == 0)
+    ss->config.queue_size = SOCKET_SINK_DEFAULT_QUEUE;
+  ss->queue_length = IOV_MAX*4;
+  ss->queue = (struct sink_batch*)calloc(ss->queue_length, sizeof(struct sink_batch));
+  ss->chunk = (uint8_t*)malloc(SOCKET_SINK_CHUNK);
+  if(ss->queue == NULL || ss->chunk == NULL){
+    free(ss->queue);
+    free(ss->chunk);
+    free(ss);
+    errno = ENOMEM;
+    return NULL;
+  }
+  ss->spill_fd = -1;
+  ss->fd = __socket_connect(ss->address);
+  if(ss->fd < 0){
+    rc = ss->fd;
+    goto error;
+  }
+  ss->running = true;
+  ss->sink.ops = &socket_sink_ops;
+  ss->sink.format = config->format;
+  ss->sink.priv = ss;
+  pthread_mutex_init(&ss->sink.lock, NULL);
+  pthread_cond_init(&ss->not_empty, NULL);
+  pthread_cond_init(&ss->not_full, NULL);
+  rc = -pthread_create(&ss->sender, NULL, socket_sender_job, ss);
+  if(rc < 0){
+    close(ss->fd);
+    pthread_cond_destroy(&ss->not_empty);
+    pthread_cond_destroy(&ss->not_full);
+    pthread_mutex_destroy(&ss->sink.lock);
+    goto error;
+  }
+  return &ss->sink;
+
+error:
+  free(ss->chunk);
+  free(ss->queue);
+  free(ss);
+  errno = -rc;
+  return NULL;
+}
@@ -13,6 +13,11 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "provenanceutils.h"
 
@@ -44,6 +49,81 @@ size_t hexify(uint8_t *in, size_t in_size, char *out, size_t out_size)
     return bytes_written;
 }
 
+static const char json_short_escape[32] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 'b', 't', 'n', 0, 'f', 'r', 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static inline bool __json_needs_escape(uint8_t c){
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+#ifdef __SSE2__
+/* bitmask of the bytes in the next 16 that need escaping (or are null) */
+static inline uint32_t __json_escape_mask(const char* in){
+  const __m128i v = _mm_loadu_si128((const __m128i*)in);
+  __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  return _mm_movemask_epi8(m);
+}
+#endif
+
+size_t json_escape(char* out, size_t outlen, const char* in, size_t inlen){
+  size_t i = 0;
+  size_t o = 0;
+  uint8_t c;
+
+  if(outlen == 0)
+    return 0;
+  outlen--; // room for the null byte
+  while(i < inlen){
+#ifdef __SSE2__
+    uint32_t mask;
+    while(i + 16 <= inlen && o + 16 <= outlen){
+      mask = __json_escape_mask(in + i);
+      if(mask != 0){
+        mask = __builtin_ctz(mask);
+        memcpy(out + o, in + i, 16);
+        i += mask;
+        o += mask;
+        break;
+      }
+      memcpy(out + o, in + i, 16);
+      i += 16;
+      o += 16;
+    }
+    if(i >= inlen)
+      break;
+#endif
+    c = in[i];
+    if(c == '\0')
+      break;
+    if(!__json_needs_escape(c)){
+      if(o + 1 > outlen)
+        break;
+      out[o++] = c;
+    }else if(c == '"' || c == '\\' || json_short_escape[c] != 0){
+      if(o + 2 > outlen)
+        break;
+      out[o++] = '\\';
+      out[o++] = (c < 0x20) ? json_short_escape[c] : c;
+    }else{
+      if(o + 6 > outlen)
+        break;
+      out[o++] = '\\';
+      out[o++] = 'u';
+      out[o++] = '0';
+      out[o++] = '0';
+      out[o++] = map[c >> 4];
+      out[o++] = map[c & 0x0F];
+    }
+    i++;
+  }
+  out[o] = '\0';
+  return o;
+}
+
 static const char base64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 // from https://en.wikibooks.org/wiki/Algorithm_Implementation/Miscellaneous/Base64#C
@@ -146,6 +226,93 @@ int compress64encode(const char* in, size_t inlen, char* out, size_t outlen){
   return 0;
 }
 
+static inline void __put_be32(uint8_t* buf, uint32_t v){
+  buf[0] = (v >> 24) & 0xFF;
+  buf[1] = (v >> 16) & 0xFF;
+  buf[2] = (v >> 8) & 0xFF;
+  buf[3] = v & 0xFF;
+}
+
+static inline uint32_t __get_be32(const uint8_t* buf){
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+int compress_stream_init(struct compress_stream* s, int level){
+  int rc;
+
+  memset(s, 0, sizeof(struct compress_stream));
+  s->level = level;
+  rc = deflateInit(&s->strm, level);
+  if(rc != Z_OK)
+    return -ENOMEM;
+  return 0;
+}
+
+/* the z_stream and output buffer are kept across calls, only reset per frame */
+int compress_stream_frame(struct compress_stream* s, const void* in, size_t inlen, uint8_t** frame, size_t* framelen){
+  size_t bound;
+  uint8_t* tmp;
+  int rc;
+
+  if(inlen > UINT32_MAX)
+    return -EINVAL;
+  bound = COMPRESS_FRAME_HEADER_LENGTH + deflateBound(&s->strm, inlen);
+  if(bound > s->out_size){
+    tmp = realloc(s->out, bound);
+    if(tmp == NULL)
+      return -ENOMEM;
+    s->out = tmp;
+    s->out_size = bound;
+  }
+
+  s->strm.next_in = (Bytef*)in;
+  s->strm.avail_in = inlen;
+  s->strm.next_out = s->out + COMPRESS_FRAME_HEADER_LENGTH;
+  s->strm.avail_out = s->out_size - COMPRESS_FRAME_HEADER_LENGTH;
+  rc = deflate(&s->strm, Z_FINISH);
+  if(rc != Z_STREAM_END){
+    deflateReset(&s->strm);
+    return -EIO;
+  }
+  __put_be32(s->out, s->strm.total_out);
+  __put_be32(s->out + sizeof(uint32_t), inlen);
+  *frame = s->out;
+  *framelen = COMPRESS_FRAME_HEADER_LENGTH + s->strm.total_out;
+  deflateReset(&s->strm);
+  return 0;
+}
+
+void compress_stream_end(struct compress_stream* s){
+  deflateEnd(&s->strm);
+  free(s->out);
+  s->out = NULL;
+  s->out_size = 0;
+}
+
+int decompress_frame(const uint8_t* frame, size_t framelen, char** out, size_t* outlen){
+  uLongf len;
+  uint32_t clen;
+  char* buf;
+
+  if(framelen < COMPRESS_FRAME_HEADER_LENGTH)
+    return -EINVAL;
+  clen = __get_be32(frame);
+  len = __get_be32(frame + sizeof(uint32_t));
+  if(clen > framelen - COMPRESS_FRAME_HEADER_LENGTH)
+    return -EINVAL;
+  buf = (char*)malloc(len + 1);
+  if(buf == NULL)
+    return -ENOMEM;
+  if(uncompress((Bytef*)buf, &len, frame + COMPRESS_FRAME_HEADER_LENGTH, clen) != Z_OK){
+    free(buf);
+    return -EIO;
+  }
+  buf[len] = '\0';
+  *out = buf;
+  *outlen = len;
+  return 0;
+}
+
 char *ulltoa (uint64_t value, char *string, int radix)
 {
   char *dst;
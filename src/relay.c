@@ -20,10 +20,14 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <time.h>
+#include <dirent.h>
 #include <linux/provenance_types.h>
 
 #include "thpool.h"
 #include "provenance.h"
+#include "provenanceutils.h"
+#include "provenancebulk.h"
+#include "provenancegraph.h"
 
 #define RUN_PID_FILE "/run/provenance-service.pid"
 #define NUMBER_CPUS           256 /* support 256 core max */
@@ -39,11 +43,50 @@ static threadpool worker_thpool=NULL;
 static uint32_t machine_id=0;
 static uint8_t running = 1;
 
+/* serialization stage, relay reads handed over from readers to workers */
+struct relay_batch{
+  uint8_t* buf;
+  size_t size;
+  size_t prov_size;
+  void (*callback)(void*, const size_t);
+};
+
+static uint32_t stage_nthreads=0; // 0, callbacks run on the reader threads
+static uint32_t stage_length=0;
+static pthread_t* stage_threads=NULL;
+static struct relay_batch* stage_queue=NULL;
+static uint32_t stage_head=0;
+static uint32_t stage_count=0;
+static uint8_t stage_running=0;
+static pthread_mutex_t stage_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stage_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stage_not_full = PTHREAD_COND_INITIALIZER;
+static struct provenance_relay_stats stage_stats;
+
+/* startup snapshot */
+static struct relay_snapshot snapshot;
+static bool snapshot_set=false;
+
+/* relay reads held back while the snapshot runs, in read order */
+struct held_batch{
+  struct relay_batch batch;
+  struct held_batch* next;
+};
+
+static uint8_t hold_running=0;
+static struct held_batch* hold_head=NULL;
+static struct held_batch* hold_tail=NULL;
+static pthread_mutex_t hold_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* internal functions */
 static int open_files(const char *name);
 static int close_files(void);
 static int create_worker_pool(void);
 static void destroy_worker_pool(void);
+static int create_stage(void);
+static void destroy_stage(void);
+static void run_snapshot(void);
+static void release_held(void);
 
 static void callback_job(void* data, const size_t prov_size);
 static void long_callback_job(void* data, const size_t prov_size);
@@ -77,6 +120,7 @@ int provenance_relay_register(struct provenance_ops* ops, const char* name)
   int err;
 
   provenance_get_machine_id(&machine_id);
+  provenance_load_types();
 
   /* the provenance usher will not appear in trace */
   err = provenance_set_opaque(true);
@@ -99,12 +143,28 @@ int provenance_relay_register(struct provenance_ops* ops, const char* name)
   if(open_files(name))
     return -1;
 
+  /* create serialization threads, before readers start queuing */
+  if(create_stage()){
+    close_files();
+    return -1;
+  }
+
+  /* readers drain the relay from the start, delivery waits for the snapshot */
+  __atomic_store_n(&hold_running, snapshot_set, __ATOMIC_RELEASE);
+
   /* create callback threads */
   if(create_worker_pool()){
+    destroy_stage();
     close_files();
     return -1;
   }
 
+  /* existing objects, before live records */
+  if(snapshot_set){
+    run_snapshot();
+    release_held();
+  }
+
   if(provenance_record_pid() < 0)
     return -1;
   return 0;
@@ -116,6 +176,36 @@ void provenance_relay_stop()
   sleep(1); // give them a bit of times
   close_files();
   destroy_worker_pool();
+  destroy_stage(); // readers are done, drain what they queued
+}
+
+int provenance_relay_set_workers(uint32_t threads, uint32_t length){
+  if(stage_queue!=NULL)
+    return -EBUSY;
+  if(threads>0 && length==0)
+    return -EINVAL;
+  stage_nthreads = threads;
+  stage_length = length;
+  return 0;
+}
+
+int provenance_relay_set_snapshot(const struct relay_snapshot* s){
+  if(worker_thpool!=NULL)
+    return -EBUSY;
+  if(s==NULL){
+    snapshot_set = false;
+    return 0;
+  }
+  memcpy(&snapshot, s, sizeof(struct relay_snapshot));
+  snapshot_set = true;
+  return 0;
+}
+
+int provenance_relay_stats(struct provenance_relay_stats* stats){
+  pthread_mutex_lock(&stage_lock);
+  memcpy(stats, &stage_stats, sizeof(struct provenance_relay_stats));
+  pthread_mutex_unlock(&stage_lock);
+  return 0;
 }
 
 static int open_files(const char* name)
@@ -184,6 +274,112 @@ static void destroy_worker_pool(void)
   thpool_destroy(worker_thpool); // destory all worker threads
 }
 
+static void* stage_job(void* data);
+
+static int create_stage(void)
+{
+  uint32_t i;
+
+  if(stage_nthreads==0)
+    return 0;
+  stage_queue = (struct relay_batch*)calloc(stage_length, sizeof(struct relay_batch));
+  stage_threads = (pthread_t*)calloc(stage_nthreads, sizeof(pthread_t));
+  if(stage_queue==NULL || stage_threads==NULL)
+    goto error;
+  memset(&stage_stats, 0, sizeof(struct provenance_relay_stats));
+  stage_stats.workers = stage_nthreads;
+  stage_running = 1;
+  for(i=0; i<stage_nthreads; i++){
+    if(pthread_create(&stage_threads[i], NULL, stage_job, NULL)!=0){
+      stage_nthreads = i;
+      destroy_stage();
+      return -1;
+    }
+  }
+  return 0;
+error:
+  free(stage_queue);
+  free(stage_threads);
+  stage_queue = NULL;
+  stage_threads = NULL;
+  return -1;
+}
+
+static void destroy_stage(void)
+{
+  uint32_t i;
+
+  if(stage_queue==NULL)
+    return;
+  pthread_mutex_lock(&stage_lock);
+  stage_running = 0;
+  pthread_cond_broadcast(&stage_not_empty);
+  pthread_mutex_unlock(&stage_lock);
+  for(i=0; i<stage_nthreads; i++)
+    pthread_join(stage_threads[i], NULL);
+  free(stage_threads);
+  free(stage_queue);
+  stage_threads = NULL;
+  stage_queue = NULL;
+}
+
+/* take ownership of buf, block the reader while the queue is full */
+static void stage_push(uint8_t* buf, size_t size, size_t prov_size, void (*callback)(void*, const size_t)){
+  struct relay_batch* batch;
+
+  pthread_mutex_lock(&stage_lock);
+  if(stage_count==stage_length)
+    stage_stats.blocked++;
+  while(stage_count==stage_length)
+    pthread_cond_wait(&stage_not_full, &stage_lock);
+  batch = &stage_queue[(stage_head+stage_count)%stage_length];
+  batch->buf = buf;
+  batch->size = size;
+  batch->prov_size = prov_size;
+  batch->callback = callback;
+  stage_count++;
+  stage_stats.queued++;
+  stage_stats.queued_records += size/prov_size;
+  stage_stats.depth = stage_count;
+  stage_stats.depth_records += size/prov_size;
+  if(stage_count > stage_stats.max_depth)
+    stage_stats.max_depth = stage_count;
+  pthread_cond_signal(&stage_not_empty);
+  pthread_mutex_unlock(&stage_lock);
+}
+
+static void* stage_job(void* data)
+{
+  struct relay_batch batch;
+  size_t i;
+
+  while(1){
+    pthread_mutex_lock(&stage_lock);
+    while(stage_count==0 && stage_running)
+      pthread_cond_wait(&stage_not_empty, &stage_lock);
+    if(stage_count==0){ // stopped and drained
+      pthread_mutex_unlock(&stage_lock);
+      return NULL;
+    }
+    memcpy(&batch, &stage_queue[stage_head], sizeof(struct relay_batch));
+    stage_head = (stage_head+1)%stage_length;
+    stage_count--;
+    stage_stats.depth = stage_count;
+    stage_stats.depth_records -= batch.size/batch.prov_size;
+    pthread_cond_signal(&stage_not_full);
+    pthread_mutex_unlock(&stage_lock);
+
+    for(i=0; i<batch.size; i+=batch.prov_size)
+      batch.callback(batch.buf+i, batch.prov_size);
+    free(batch.buf);
+
+    pthread_mutex_lock(&stage_lock);
+    stage_stats.processed++;
+    stage_stats.processed_records += batch.size/batch.prov_size;
+    pthread_mutex_unlock(&stage_lock);
+  }
+}
+
 /* per worker thread initialised variable */
 static __thread int initialised=0;
 
@@ -243,7 +439,7 @@ void node_record(union prov_elt *msg){
 }
 
 void prov_record(union prov_elt* msg){
-
+  provenance_graph_record(msg);
   if(prov_is_relation(msg))
     relation_record(msg);
   else
@@ -261,6 +457,8 @@ static void callback_job(void* data, const size_t prov_size)
   msg = (union prov_elt*)data;
   if(prov_type(msg)!=ENT_PACKET)
     node_identifier(msg).machine_id = machine_id;
+  if(prov_type(msg)==RL_NAMED)
+    provenance_path_cache_named(&(msg->relation_info));
   /* initialise per worker thread */
   if(!initialised && prov_ops.init!=NULL){
     prov_ops.init();
@@ -281,6 +479,7 @@ out:
 }
 
 void long_prov_record(union long_prov_elt* msg){
+  provenance_graph_long_record(msg);
   switch(prov_type(msg)){
     case ENT_STR:
       if(prov_ops.log_str!=NULL)
@@ -335,6 +534,8 @@ static void long_callback_job(void* data, const size_t prov_size)
   }
   msg = (union long_prov_elt*)data;
   node_identifier(msg).machine_id = machine_id;
+  if(prov_type(msg)==ENT_FILE_NAME)
+    provenance_path_cache_name(&(msg->file_name_info));
 
   /* initialise per worker thread */
   if(!initialised && prov_ops.init!=NULL){
@@ -355,12 +556,192 @@ out:
   long_prov_record(msg);
 }
 
+/*
+* Startup snapshot. Processes are read in chunks of pids on a temporary pool,
+* files through the tree walk; records go through the callbacks used for
+* relay records, from the snapshot threads. Relay readers are already
+* running meanwhile, what they read is held (see hold_push) so the kernel
+* buffers do not fill up during a long walk.
+*/
+#define SNAPSHOT_CHUNK 64
+
+struct snapshot_job{
+  uint32_t* pids;
+  size_t count;
+};
+
+static void snapshot_process_job(void* data){
+  struct snapshot_job* job = (struct snapshot_job*)data;
+  union prov_elt prov;
+  size_t i;
+
+  for(i=0; i<job->count; i++){
+    memset(&prov, 0, sizeof(union prov_elt));
+    if(provenance_read_process(job->pids[i], &prov)<0)
+      continue; // exited meanwhile
+    callback_job(&prov, sizeof(union prov_elt));
+  }
+}
+
+static void snapshot_processes(uint32_t threads){
+  struct snapshot_job* jobs;
+  threadpool pool;
+  uint32_t* pids=NULL;
+  uint32_t* tmp;
+  size_t count=0;
+  size_t size=0;
+  size_t njobs;
+  size_t i;
+  struct dirent* d;
+  DIR* proc;
+  char* end;
+  unsigned long pid;
+
+  proc = opendir("/proc");
+  if(proc==NULL){
+    record_error("Snapshot: could not open /proc (%d).", errno);
+    return;
+  }
+  while((d = readdir(proc))!=NULL){
+    pid = strtoul(d->d_name, &end, 10);
+    if(*end!='\0' || pid==0)
+      continue;
+    if(count==size){
+      size = (size==0) ? 1024 : size*2;
+      tmp = realloc(pids, size*sizeof(uint32_t));
+      if(tmp==NULL)
+        break;
+      pids = tmp;
+    }
+    pids[count++] = pid;
+  }
+  closedir(proc);
+  if(count==0){
+    free(pids);
+    return;
+  }
+  njobs = (count+SNAPSHOT_CHUNK-1)/SNAPSHOT_CHUNK;
+  jobs = (struct snapshot_job*)calloc(njobs, sizeof(struct snapshot_job));
+  pool = (jobs!=NULL) ? thpool_init(threads) : NULL;
+  if(pool==NULL){
+    record_error("Snapshot: could not start workers.");
+    free(jobs);
+    free(pids);
+    return;
+  }
+  for(i=0; i<njobs; i++){
+    jobs[i].pids = pids+i*SNAPSHOT_CHUNK;
+    jobs[i].count = (i+1<njobs) ? SNAPSHOT_CHUNK : count-i*SNAPSHOT_CHUNK;
+    if(thpool_add_work(pool, snapshot_process_job, &jobs[i])!=0)
+      snapshot_process_job(&jobs[i]);
+  }
+  thpool_wait(pool);
+  thpool_destroy(pool);
+  free(jobs);
+  free(pids);
+}
+
+static void snapshot_inode(union prov_elt* inode, const char* path, void* data){
+  if(snapshot.tracked_only && !prov_check_flag(inode, TRACKED_BIT))
+    return;
+  callback_job(inode, sizeof(union prov_elt));
+}
+
+static void run_snapshot(void){
+  struct tree_config config;
+  uint32_t threads = snapshot.threads;
+  size_t i;
+  int rc;
+
+  if(threads==0)
+    threads = ncpus;
+  if(snapshot.processes)
+    snapshot_processes(threads);
+  memset(&config, 0, sizeof(struct tree_config));
+  config.op = TREE_READ;
+  config.inode = snapshot_inode;
+  config.threads = threads;
+  for(i=0; i<snapshot.directory_count; i++){
+    rc = provenance_tree_apply(snapshot.directories[i], &config, NULL);
+    if(rc<0)
+      record_error("Snapshot: could not walk %s (%d).", snapshot.directories[i], rc);
+    else if(rc>0)
+      record_error("Snapshot: %d files of %s could not be read.", rc, snapshot.directories[i]);
+  }
+}
+
+/* take ownership of buf, run the callbacks or queue it for the serialization stage */
+static void deliver(uint8_t* buf, size_t size, size_t prov_size, void (*callback)(void*, const size_t)){
+  size_t i;
+
+  if(stage_queue!=NULL && size>0){ // hand over to the serialization stage
+    stage_push(buf, size, prov_size, callback);
+    return;
+  }
+  for(i=0; i<size; i+=prov_size)
+    callback(buf+i, prov_size);
+  free(buf);
+}
+
+/* take ownership of buf if delivery is held, return false otherwise */
+static bool hold_push(uint8_t* buf, size_t size, size_t prov_size, void (*callback)(void*, const size_t)){
+  struct held_batch* held;
+
+  if(!__atomic_load_n(&hold_running, __ATOMIC_ACQUIRE))
+    return false;
+  held = (struct held_batch*)malloc(sizeof(struct held_batch));
+  if(held==NULL)
+    return false; // delivered out of order rather than lost
+  held->batch.buf = buf;
+  held->batch.size = size;
+  held->batch.prov_size = prov_size;
+  held->batch.callback = callback;
+  held->next = NULL;
+  pthread_mutex_lock(&hold_lock);
+  if(!hold_running){ // released meanwhile
+    pthread_mutex_unlock(&hold_lock);
+    free(held);
+    return false;
+  }
+  if(hold_tail!=NULL)
+    hold_tail->next = held;
+  else
+    hold_head = held;
+  hold_tail = held;
+  pthread_mutex_unlock(&hold_lock);
+  return true;
+}
+
+/*
+* deliver what readers held during the snapshot. Readers keep holding until
+* the list is found empty, so that live records never overtake held ones.
+*/
+static void release_held(void){
+  struct held_batch* held;
+  struct held_batch* next;
+
+  while(1){
+    pthread_mutex_lock(&hold_lock);
+    held = hold_head;
+    hold_head = NULL;
+    hold_tail = NULL;
+    if(held==NULL)
+      __atomic_store_n(&hold_running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&hold_lock);
+    if(held==NULL)
+      return;
+    for(; held!=NULL; held=next){
+      next = held->next;
+      deliver(held->batch.buf, held->batch.size, held->batch.prov_size, held->batch.callback);
+      free(held);
+    }
+  }
+}
+
 #define buffer_size(prov_size) (prov_size*1000)
 static void ___read_relay( const int relay_file, const size_t prov_size, void (*callback)(void*, const size_t)){
 	uint8_t *buf;
-	uint8_t* entry;
   size_t size=0;
-  size_t i=0;
   int rc;
 	buf = (uint8_t*)malloc(buffer_size(prov_size));
 	do{
@@ -375,13 +756,9 @@ static void ___read_relay( const int relay_file, const size_t prov_size, void (*
 		size += rc;
 	}while(size%prov_size!=0);
 
-	while(size>0){
-		entry = buf+i;
-		size-=prov_size;
-		i+=prov_size;
-		callback(entry, prov_size);
-	}
-	free(buf);
+  if(size>0 && hold_push(buf, size, prov_size, callback))
+    return;
+  deliver(buf, size, prov_size, callback);
 }
 
 #define POL_FLAG (POLLIN|POLLRDNORM|POLLERR)